@@ -0,0 +1,118 @@
+#include "math.h"
+#include "renderer.h"
+#include "scene.h"
+#include "sdf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Shading LOD benchmark: renders a terrain scene with a range of RenderSettings::shadingLodSpread
+// thresholds and compares every frame against a high sample reference rendered at full quality.
+
+static std::unique_ptr<Scene> buildScene()
+{
+	SceneBuilder builder;
+	builder.SetAggregate(AggregateType::BVH);
+	Material *rock = builder.AddMaterial(vector3(0.45f, 0.4f, 0.35f), 0.8f, 0.0f);
+	Material *gold = builder.AddMaterial(vector3(1.0f, 0.78f, 0.34f), 0.3f, 1.0f);
+	Material *plastic = builder.AddMaterial(vector3(0.1f, 0.3f, 0.8f), 0.2f, 0.0f);
+	builder.SetSky(vector3(0.4f, 0.6f, 0.9f));
+
+	std::unique_ptr<SdfShape> terrain = std::make_unique<SdfShape>(
+		std::make_unique<SdfTerrain>(vector3(0.0f, -1.0f, -6.0f), 6.0f, 0.6f, 0.5f, 5, 7), 1e-4f);
+	terrain->BuildBrickCache();
+	builder.AddShape(std::move(terrain), rock);
+	builder.AddSphere(vector3(-0.8f, 0.2f, -4.0f), 0.5f, gold);
+	builder.AddSphere(vector3(0.9f, 0.1f, -4.5f), 0.5f, plastic);
+	builder.AddLight(vector3(-2.0f, 4.0f, -1.0f), vector3(1.0f, 0.95f, 0.9f), 60.0f);
+	return builder.Build();
+}
+
+// Best time out of runs renders, the image of the last one is returned.
+static std::vector<float> render(Renderer &renderer, const Scene &scene, RenderSettings settings, int runs, double *seconds)
+{
+	std::vector<float> image;
+	*seconds = std::numeric_limits<double>::infinity();
+	for (int run = 0; run < runs; ++run)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::shared_ptr<RenderJob> job = renderer.Submit(scene, settings);
+		job->Wait();
+		*seconds = std::min(*seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		image = job->GetFramebuffer();
+	}
+	return image;
+}
+
+static double rmse(const std::vector<float> &image, const std::vector<float> &reference)
+{
+	double sum = 0.0;
+	size_t count = 0;
+	for (size_t i = 0; i < image.size(); ++i)
+	{
+		if (!std::isfinite(image[i]) || !std::isfinite(reference[i])) continue;
+		double d = image[i] - reference[i];
+		sum += d * d;
+		count++;
+	}
+	return count > 0 ? std::sqrt(sum / count) : 0.0;
+}
+
+static double mean(const std::vector<float> &image)
+{
+	double sum = 0.0;
+	for (float v : image)
+	{
+		if (std::isfinite(v)) sum += v;
+	}
+	return sum / image.size();
+}
+
+int main()
+{
+	std::unique_ptr<Scene> scene = buildScene();
+	Renderer renderer;
+
+	RenderSettings settings;
+	settings.width = 240;
+	settings.height = 135;
+	settings.bounceCount = 6;
+	settings.denoise = false;
+	settings.fov = 50.0f;
+
+	const float infinity = std::numeric_limits<float>::infinity();
+	const int referenceSamples = 256;
+	const int sampleCount = 16;
+	const int timingRuns = 3;
+
+	double seconds;
+	settings.sampleCount = referenceSamples;
+	settings.shadingLodSpread = infinity;
+	std::vector<float> reference = render(renderer, *scene, settings, 1, &seconds);
+	const double referenceMean = mean(reference);
+	std::cout << "reference: " << referenceSamples << " spp, " << settings.width << "x" << settings.height
+		<< ", " << std::fixed << std::setprecision(2) << seconds << " s" << std::endl;
+
+	std::cout << std::setw(12) << "threshold" << std::setw(10) << "time s" << std::setw(10) << "speedup"
+		<< std::setw(10) << "rmse" << std::setw(12) << "mean bias" << std::endl;
+	settings.sampleCount = sampleCount;
+	double baseline = 0.0;
+	for (float threshold : { infinity, 2.0f, 1.0f, 0.5f, 0.25f, 0.0f })
+	{
+		settings.shadingLodSpread = threshold;
+		std::vector<float> image = render(renderer, *scene, settings, timingRuns, &seconds);
+		if (baseline == 0.0)
+		{
+			baseline = seconds;
+		}
+		std::cout << std::setw(12) << std::setprecision(2) << threshold << std::setw(10) << std::setprecision(3) << seconds
+			<< std::setw(10) << std::setprecision(2) << baseline / seconds << std::setw(10) << std::setprecision(4) << rmse(image, reference)
+			<< std::setw(11) << std::setprecision(2) << 100.0 * (mean(image) / referenceMean - 1.0) << "%" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "bounds.h"
+
+#include <algorithm>
+#include <cmath>
+
+AABB AABB::Infinite()
+{
+	float inf = std::numeric_limits<float>::infinity();
+	return AABB(vector3(-inf), vector3(inf));
+}
+
+bool AABB::IsFinite() const
+{
+	return std::isfinite(min.x) && std::isfinite(min.y) && std::isfinite(min.z)
+		&& std::isfinite(max.x) && std::isfinite(max.y) && std::isfinite(max.z);
+}
+
+float AABB::SurfaceArea() const
+{
+	if (IsEmpty()) return 0.0f;
+	vector3 e = Extent();
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+int AABB::LongestAxis() const
+{
+	vector3 e = Extent();
+	if (e.x >= e.y && e.x >= e.z) return 0;
+	return e.y >= e.z ? 1 : 2;
+}
+
+AABB &AABB::Expand(const vector3 &p)
+{
+	min = vector3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+	max = vector3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	return *this;
+}
+
+AABB &AABB::Expand(const AABB &b)
+{
+	min = vector3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+	max = vector3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+	return *this;
+}
+
+AABB AABB::Grow(float amount) const
+{
+	return AABB(min - vector3(amount), max + vector3(amount));
+}
+
+bool AABB::Intersect(const Ray &ray, float *t0, float *t1) const
+{
+	float tNear = 0.0f;
+	float tFar = ray.tMax;
+	const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	const float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+	const float lo[3] = { min.x, min.y, min.z };
+	const float hi[3] = { max.x, max.y, max.z };
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float rcpDir = 1.0f / direction[axis];
+		float tA = (lo[axis] - origin[axis]) * rcpDir;
+		float tB = (hi[axis] - origin[axis]) * rcpDir;
+		if (tA > tB) std::swap(tA, tB);
+		// NaN from a zero direction on a slab boundary must not shrink the interval
+		if (tA > tNear) tNear = tA;
+		if (tB < tFar) tFar = tB;
+		if (tNear > tFar) return false;
+	}
+
+	*t0 = tNear;
+	*t1 = tFar;
+	return true;
+}
+
+AABB Union(const AABB &a, const AABB &b)
+{
+	AABB result = a;
+	return result.Expand(b);
+}
+
+AABB Intersection(const AABB &a, const AABB &b)
+{
+	return AABB(vector3(std::max(a.min.x, b.min.x), std::max(a.min.y, b.min.y), std::max(a.min.z, b.min.z)),
+		vector3(std::min(a.max.x, b.max.x), std::min(a.max.y, b.max.y), std::min(a.max.z, b.max.z)));
+}
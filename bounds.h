@@ -0,0 +1,39 @@
+#pragma once
+
+#include "math.h"
+#include "ray.h"
+
+#include <limits>
+
+// Axis aligned bounding box, empty by default.
+class AABB
+{
+public:
+	AABB()
+		: min(std::numeric_limits<float>::infinity())
+		, max(-std::numeric_limits<float>::infinity())
+		{}
+	AABB(vector3 min_, vector3 max_): min(min_), max(max_) {}
+
+	static AABB Infinite();
+
+	bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+	bool IsFinite() const;
+	vector3 Center() const { return (min + max) * 0.5f; }
+	vector3 Extent() const { return max - min; }
+	float SurfaceArea() const;
+	int LongestAxis() const;
+
+	AABB &Expand(const vector3 &p);
+	AABB &Expand(const AABB &b);
+	AABB Grow(float amount) const;
+
+	// Slab test against [0, ray.tMax], returns the clipped interval in t0 and t1.
+	bool Intersect(const Ray &ray, float *t0, float *t1) const;
+
+	vector3 min;
+	vector3 max;
+};
+
+AABB Union(const AABB &a, const AABB &b);
+AABB Intersection(const AABB &a, const AABB &b);
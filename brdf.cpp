@@ -0,0 +1,95 @@
+#include "brdf.h"
+
+#include <algorithm>
+#include <cmath>
+
+float disneySchlick(float u)
+{
+	return std::pow(1.0f - u, 5.0f);
+}
+
+float disneyGTR2(float NdotH, float alpha) {
+	float alpha2 = alpha * alpha;
+	float t = 1.0f + (alpha2 - 1.0f) * NdotH * NdotH;
+	return alpha2 / (pi * t * t);
+}
+
+float disneySmithG_GGX(float NdotV, float alphaG) {
+	float a = alphaG * alphaG;
+	float b = NdotV * NdotV;
+	return 1.0 / (NdotV + sqrt(a + b - a * b));
+}
+
+Spectrum DisneyBRDF(vector3 N, vector3 L, vector3 V, const Spectrum &baseColor, float roughness, float metalness)
+{
+	float NdotV = N.dot(V);
+	float NdotL = N.dot(L);
+	if (NdotV <= 0.0f || NdotL <= 0.0f) return Spectrum(); // the Smith terms blow up below the horizon
+
+	roughness = std::max(0.001f, roughness); // just in case
+
+	vector3 H = (L + V).normalized();
+	float LdotH = L.dot(H);
+	float NdotH = N.dot(H);
+
+	Spectrum f0 = lerp(Spectrum(0.04f), baseColor, metalness); // 4% reflectivity for dielectrics
+
+	//diffuse
+	float FL = disneySchlick(NdotL);
+	float FV = disneySchlick(NdotV);
+	float Fd90 = 0.5f + 2.0f * NdotH * LdotH * roughness;
+	float Fd = lerp(1.0f, Fd90, FL) * lerp(1.0f, Fd90, FV);
+
+	//specular
+	float alpha = roughness * roughness;
+	float Ds = disneyGTR2(NdotH, alpha);
+	float FH = disneySchlick(LdotH);
+	Spectrum Fs = lerp(f0, Spectrum(1.0f), FH);
+	float roughg = (roughness * 0.5f + 0.5f) * (roughness * 0.5f + 0.5f);
+	float Gs = disneySmithG_GGX(NdotL, roughg) * disneySmithG_GGX(NdotV, roughg);
+
+	// all scalar terms first, the color channels are combined in one go
+	return (baseColor * (rcpPi * Fd * (1.0f - metalness)) + Fs * (Gs * Ds)) * clamp(NdotL, 0.0f, 1.0f);
+}
+
+Spectrum SimpleBRDF(vector3 N, vector3 L, vector3 V, const Spectrum &baseColor, float roughness, float metalness)
+{
+	float NdotV = N.dot(V);
+	float NdotL = N.dot(L);
+	if (NdotV <= 0.0f || NdotL <= 0.0f) return Spectrum();
+
+	roughness = std::max(0.001f, roughness);
+
+	vector3 H = (L + V).normalized();
+	float LdotH = L.dot(H);
+	float NdotH = N.dot(H);
+
+	Spectrum f0 = lerp(Spectrum(0.04f), baseColor, metalness);
+	float Ds = disneyGTR2(NdotH, roughness * roughness);
+	return (baseColor * (rcpPi * (1.0f - metalness)) + f0 * (Ds / (4.0f * LdotH * LdotH))) * NdotL;
+}
+
+void coordinateSystem(const vector3 &v1, vector3 *v2, vector3 *v3)
+{
+	if (std::abs(v1.x) > std::abs(v1.y))
+	{
+		*v2 = vector3(-v1.z, 0.0f, v1.x) / std::sqrt(v1.x * v1.x + v1.z * v1.z);
+	}
+	else
+	{
+		*v2 = vector3(0.0f, v1.z, -v1.y) / std::sqrt(v1.y * v1.y + v1.z * v1.z);
+	}
+	*v3 = v1.cross(*v2);
+}
+
+float ImportanceSampleGGXPdf(vector3 normal, vector3 wo, vector3 wi, float roughness)
+{
+	// half vectors are distributed as D * cos, the reflection maps them with a jacobian of 1 / (4 wo.h)
+	if (normal.dot(wi) <= 0.0f) return 0.0f;
+	roughness = std::max(0.001f, roughness);
+	vector3 wm = (wo + wi).normalized();
+	float dotWoWm = wo.dot(wm);
+	if (dotWoWm <= 0.0f) return 0.0f;
+	float NdotH = normal.dot(wm);
+	return disneyGTR2(NdotH, roughness * roughness) * NdotH / (4.0f * dotWoWm);
+}
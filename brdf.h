@@ -0,0 +1,18 @@
+#pragma once
+
+#include "math.h"
+#include "spectrum.h"
+
+float disneySchlick(float u);
+float disneyGTR2(float NdotH, float alpha);
+float disneySmithG_GGX(float NdotV, float alphaG);
+// baseColor is the material color in the representation of the path, RGB or the sampled wavelengths.
+Spectrum DisneyBRDF(vector3 N, vector3 L, vector3 V, const Spectrum &baseColor, float roughness, float metalness);
+// Cheaper stand-in for DisneyBRDF on blurry paths: Lambert plus GGX with Kelemen's visibility term
+// and without Fresnel falloff.
+Spectrum SimpleBRDF(vector3 N, vector3 L, vector3 V, const Spectrum &baseColor, float roughness, float metalness);
+
+void coordinateSystem(const vector3 &v1, vector3 *v2, vector3 *v3);
+
+// Solid angle density of GGX half vectors reflected around, the specular lobe of BSDF::Sample.
+float ImportanceSampleGGXPdf(vector3 normal, vector3 wo, vector3 wi, float roughness);
@@ -0,0 +1,124 @@
+#include "bsdf.h"
+#include "brdf.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Unpolarized Fresnel reflectance of a smooth dielectric, eta is the ratio of the indices of the
+// far side over the side of cosThetaI.
+static float fresnelDielectric(float cosThetaI, float eta)
+{
+	float sin2ThetaT = (1.0f - cosThetaI * cosThetaI) / (eta * eta);
+	if (sin2ThetaT >= 1.0f) return 1.0f; // total internal reflection
+	float cosThetaT = std::sqrt(1.0f - sin2ThetaT);
+	float rs = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	float rp = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+static vector3 toWorld(const vector3 &local, const vector3 &normal)
+{
+	vector3 tangent;
+	vector3 binormal;
+	coordinateSystem(normal, &tangent, &binormal);
+	return tangent * local.x + normal * local.y + binormal * local.z;
+}
+
+// Cauchy's equation around the sodium D line the base index is given at, lambda in nm.
+static float cauchyIor(float ior, float b, float lambda)
+{
+	const float micrometers = lambda * 1e-3f;
+	return ior + b * (1.0f / (micrometers * micrometers) - 1.0f / (0.5893f * 0.5893f));
+}
+
+BSDF::BSDF(const Material &m, const Spectrum &color, const vector3 &normal, const vector3 &wo, bool simple,
+	const SampledWavelengths *wavelengths)
+	: m_color(color)
+	, m_normal(normal)
+	, m_wo(wo)
+	, m_roughness(m.roughness)
+	, m_metalness(m.metalness)
+	, m_ior(wavelengths && m.dispersion != 0.0f ? cauchyIor(m.ior, m.dispersion, wavelengths->lambda[0]) : m.ior)
+	, m_dispersive(wavelengths && m.dispersion != 0.0f)
+	, m_simple(simple)
+	, m_transmission(m.transmission * (1.0f - m.metalness))
+{
+	// the lobes' albedos, roughly: the diffuse color and Schlick's Fresnel at wo
+	const float NdotV = normal.dot(wo);
+	const float opaque = NdotV > 0.0f ? 1.0f - m_transmission : 0.0f;
+	const float albedo = (m.color.x + m.color.y + m.color.z) / 3.0f;
+	const float f0 = lerp(0.04f, albedo, m.metalness);
+	float diffuse = opaque * (1.0f - m.metalness) * albedo;
+	float specular = opaque * lerp(f0, 1.0f, disneySchlick(clamp(NdotV, 0.0f, 1.0f)));
+	float dielectric = m_transmission;
+	const float total = diffuse + specular + dielectric;
+	m_diffuse = total > 0.0f ? diffuse / total : 0.0f;
+	m_specular = total > 0.0f ? specular / total : 0.0f;
+	m_dielectric = total > 0.0f ? dielectric / total : 0.0f;
+}
+
+Spectrum BSDF::Eval(const vector3 &wi) const
+{
+	if (m_transmission >= 1.0f) return Spectrum();
+	Spectrum f = m_simple ? SimpleBRDF(m_normal, wi, m_wo, m_color, m_roughness, m_metalness)
+		: DisneyBRDF(m_normal, wi, m_wo, m_color, m_roughness, m_metalness);
+	return f * (1.0f - m_transmission);
+}
+
+float BSDF::Pdf(const vector3 &wi) const
+{
+	float cosTheta = m_normal.dot(wi);
+	if (cosTheta <= 0.0f) return 0.0f;
+	return m_diffuse * cosTheta * rcpPi + (m_specular > 0.0f ? m_specular * ImportanceSampleGGXPdf(m_normal, m_wo, wi, m_roughness) : 0.0f);
+}
+
+Spectrum BSDF::Sample(float u, float e0, float e1, vector3 *wi, float *pdf, Lobe *lobe) const
+{
+	if (u < m_diffuse)
+	{
+		// cosine weighted, matches the falloff of the diffuse lobe
+		*lobe = Lobe::Diffuse;
+		float r = std::sqrt(e0);
+		float phi = 2.0f * pi * e1;
+		*wi = toWorld(vector3(r * std::cos(phi), std::sqrt(std::max(0.0f, 1.0f - e0)), r * std::sin(phi)), m_normal);
+	}
+	else if (u < m_diffuse + m_specular)
+	{
+		// half vectors distributed as D times their cosine, reflected around
+		*lobe = Lobe::Specular;
+		float alpha = std::max(0.001f, m_roughness); // matches DisneyBRDF
+		alpha *= alpha;
+		float cosTheta = std::sqrt((1.0f - e0) / ((alpha * alpha - 1.0f) * e0 + 1.0f));
+		float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = 2.0f * pi * e1;
+		vector3 wm = toWorld(vector3(sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi)), m_normal);
+		*wi = 2.0f * m_wo.dot(wm) * wm - m_wo;
+	}
+	else if (m_dielectric > 0.0f)
+	{
+		*lobe = Lobe::Dielectric;
+		*pdf = m_dielectric;
+		const bool entering = m_normal.dot(m_wo) > 0.0f;
+		const vector3 n = entering ? m_normal : -m_normal;
+		const float eta = entering ? m_ior : 1.0f / m_ior;
+		const float cosThetaI = n.dot(m_wo);
+		const float reflectance = fresnelDielectric(cosThetaI, eta);
+		if (e0 < reflectance)
+		{
+			*wi = 2.0f * cosThetaI * n - m_wo;
+			return Spectrum(m_transmission);
+		}
+		const float cosThetaT = std::sqrt(std::max(0.0f, 1.0f - (1.0f - cosThetaI * cosThetaI) / (eta * eta)));
+		*wi = (-m_wo / eta + n * (cosThetaI / eta - cosThetaT)).normalized();
+		return m_color * m_transmission;
+	}
+	else
+	{
+		*pdf = 0.0f;
+		return Spectrum();
+	}
+
+	*pdf = Pdf(*wi);
+	return Eval(*wi);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "math.h"
+#include "spectrum.h"
+
+class Material;
+
+// Scattering at one surface hit, built from the material evaluated there. Three lobes: Disney
+// diffuse, GGX reflection and, for transmissive materials, a smooth dielectric that reflects or
+// refracts by its Fresnel term. Sample() picks one of them with probabilities estimated from the
+// material's albedo and Fresnel reflectance at wo. wo and wi point away from the surface; normal is
+// the geometric normal, the reflection lobes only see its front side while the dielectric works
+// from both.
+class BSDF
+{
+public:
+	enum class Lobe
+	{
+		Diffuse,
+		Specular,
+		Dielectric, // delta distribution, never part of Eval() or Pdf()
+	};
+
+	// color replaces m.color, converted to the representation of the path. simple shades the
+	// reflection with SimpleBRDF instead of DisneyBRDF. wavelengths are those of a spectral path,
+	// a dispersive dielectric refracts the hero wavelength with its own index then.
+	BSDF(const Material &m, const Spectrum &color, const vector3 &normal, const vector3 &wo, bool simple,
+		const SampledWavelengths *wavelengths = nullptr);
+
+	// True if all of the scattering is in the dielectric lobe, only Sample() can find it.
+	bool IsDelta() const { return m_dielectric >= 1.0f; }
+	// True if the dielectric lobe samples for the hero wavelength only, the path has to drop the
+	// other wavelengths once it follows such a direction.
+	bool IsDispersive() const { return m_dispersive; }
+
+	// BSDF times the cosine, without the dielectric lobe.
+	Spectrum Eval(const vector3 &wi) const;
+	// Solid angle density of Sample() producing wi, without the dielectric lobe.
+	float Pdf(const vector3 &wi) const;
+	// Picks a lobe with u and samples a direction from it with e0, e1. The diffuse and specular lobes
+	// return Eval(wi) and write Pdf(wi) to pdf. The dielectric lobe returns the weight of reflecting
+	// or refracting, which it chooses by the Fresnel term, and writes the probability of the lobe.
+	// pdf is zero if there is nothing to sample.
+	Spectrum Sample(float u, float e0, float e1, vector3 *wi, float *pdf, Lobe *lobe) const;
+
+private:
+	Spectrum m_color;
+	vector3 m_normal;
+	vector3 m_wo;
+	float m_roughness;
+	float m_metalness;
+	float m_ior;
+	bool m_dispersive;
+	bool m_simple;
+	float m_transmission; // share of the dielectric in the material
+	// lobe selection probabilities
+	float m_diffuse;
+	float m_specular;
+	float m_dielectric;
+};
@@ -0,0 +1,337 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+static const int binCount = 12;
+static const int maxBinaryDepth = 64;
+
+std::vector<uint32_t> CompressedBVH::Build(const std::vector<AABB> &bounds, int leafSize)
+{
+	m_nodes.clear();
+	m_bounds = AABB();
+	m_leafSize = std::min(std::max(leafSize, 1), 255);
+
+	std::vector<uint32_t> order(bounds.size());
+	for (uint32_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+		m_bounds.Expand(bounds[i]);
+	}
+	if (bounds.empty()) return order;
+
+	std::vector<vector3> centroids(bounds.size());
+	for (size_t i = 0; i < bounds.size(); ++i)
+	{
+		centroids[i] = bounds[i].Center();
+	}
+
+	std::vector<BuildNode> nodes;
+	nodes.reserve(bounds.size() * 2);
+	int root = BuildBinary(bounds, centroids, order, 0, static_cast<uint32_t>(bounds.size()), 0, nodes);
+
+	if (nodes[root].left < 0)
+	{
+		// a single leaf still needs a node above it
+		BuildNode parent;
+		parent.bounds = nodes[root].bounds;
+		parent.left = root;
+		nodes.push_back(parent);
+		root = static_cast<int>(nodes.size()) - 1;
+	}
+	m_nodes.reserve(bounds.size() / 2 + 1);
+	Collapse(nodes, root);
+	m_nodes.shrink_to_fit();
+	return order;
+}
+
+int CompressedBVH::BuildBinary(const std::vector<AABB> &bounds, const std::vector<vector3> &centroids, std::vector<uint32_t> &order,
+	uint32_t first, uint32_t count, int depth, std::vector<BuildNode> &nodes) const
+{
+	BuildNode node;
+	node.first = first;
+	node.count = count;
+	AABB centroidBounds;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		node.bounds.Expand(bounds[order[i]]);
+		centroidBounds.Expand(centroids[order[i]]);
+	}
+
+	const int index = static_cast<int>(nodes.size());
+	nodes.push_back(node);
+	if (count <= static_cast<uint32_t>(m_leafSize))
+	{
+		return index;
+	}
+
+	// binned SAH along the widest centroid axis, a median split when the centroids coincide
+	const int axis = centroidBounds.LongestAxis();
+	const float lo = (&centroidBounds.min.x)[axis];
+	const float extent = (&centroidBounds.max.x)[axis] - lo;
+	uint32_t mid = first + count / 2;
+
+	if (extent > 0.0f && depth < maxBinaryDepth)
+	{
+		AABB binBounds[binCount];
+		uint32_t binItems[binCount] = {};
+		auto binOf = [&](uint32_t item)
+		{
+			int bin = static_cast<int>(((&centroids[item].x)[axis] - lo) / extent * binCount);
+			return std::min(std::max(bin, 0), binCount - 1);
+		};
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			int bin = binOf(order[i]);
+			binBounds[bin].Expand(bounds[order[i]]);
+			binItems[bin]++;
+		}
+
+		float rightArea[binCount];
+		uint32_t rightItems[binCount];
+		AABB accumulated;
+		uint32_t items = 0;
+		for (int bin = binCount - 1; bin > 0; --bin)
+		{
+			accumulated.Expand(binBounds[bin]);
+			items += binItems[bin];
+			rightArea[bin] = accumulated.SurfaceArea();
+			rightItems[bin] = items;
+		}
+
+		float bestCost = std::numeric_limits<float>::infinity();
+		int bestSplit = -1;
+		accumulated = AABB();
+		items = 0;
+		for (int split = 1; split < binCount; ++split)
+		{
+			accumulated.Expand(binBounds[split - 1]);
+			items += binItems[split - 1];
+			if (items == 0 || rightItems[split] == 0) continue;
+			float cost = accumulated.SurfaceArea() * items + rightArea[split] * rightItems[split];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = split;
+			}
+		}
+
+		if (bestSplit > 0)
+		{
+			auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t item)
+			{
+				return binOf(item) < bestSplit;
+			});
+			mid = static_cast<uint32_t>(middle - order.begin());
+		}
+	}
+	else
+	{
+		std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](uint32_t a, uint32_t b)
+		{
+			return (&centroids[a].x)[axis] < (&centroids[b].x)[axis];
+		});
+	}
+
+	int left = BuildBinary(bounds, centroids, order, first, mid - first, depth + 1, nodes);
+	int right = BuildBinary(bounds, centroids, order, mid, first + count - mid, depth + 1, nodes);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+uint32_t CompressedBVH::Collapse(const std::vector<BuildNode> &nodes, int binary)
+{
+	// pull grandchildren up until the node has four children, largest inner child first
+	std::vector<int> children;
+	children.push_back(nodes[binary].left);
+	if (nodes[binary].right >= 0) children.push_back(nodes[binary].right);
+	while (children.size() < 4)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			const BuildNode &child = nodes[children[i]];
+			if (child.left >= 0 && child.bounds.SurfaceArea() > bestArea)
+			{
+				bestArea = child.bounds.SurfaceArea();
+				best = static_cast<int>(i);
+			}
+		}
+		if (best < 0) break;
+		int expanded = children[best];
+		children[best] = nodes[expanded].left;
+		children.push_back(nodes[expanded].right);
+	}
+
+	const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.emplace_back();
+
+	// quantization grid: a power of two step per axis so 255 steps cover the node
+	AABB bounds;
+	for (int child : children)
+	{
+		bounds.Expand(nodes[child].bounds);
+	}
+	const float origin[3] = { bounds.min.x, bounds.min.y, bounds.min.z };
+	const float extent[3] = { bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+	float scale[3];
+	int8_t exponent[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int e = extent[axis] > 0.0f ? static_cast<int>(std::ceil(std::log2(extent[axis] / 254.0f))) : -126;
+		e = std::min(std::max(e, -126), 127);
+		exponent[axis] = static_cast<int8_t>(e);
+		scale[axis] = exponentScale(e);
+	}
+
+	CompressedBVHNode node = {};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		node.origin[axis] = origin[axis];
+		node.exponent[axis] = exponent[axis];
+	}
+	node.childCount = static_cast<uint8_t>(children.size());
+
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		const BuildNode &child = nodes[children[i]];
+		const float childMin[3] = { child.bounds.min.x, child.bounds.min.y, child.bounds.min.z };
+		const float childMax[3] = { child.bounds.max.x, child.bounds.max.y, child.bounds.max.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			// round outwards and check against the decoded value so float rounding never shrinks a box
+			int lo = static_cast<int>(std::floor((childMin[axis] - origin[axis]) / scale[axis]));
+			int hi = static_cast<int>(std::ceil((childMax[axis] - origin[axis]) / scale[axis]));
+			lo = std::min(std::max(lo, 0), 255);
+			hi = std::min(std::max(hi, 0), 255);
+			while (lo > 0 && origin[axis] + lo * scale[axis] > childMin[axis]) --lo;
+			while (hi < 255 && origin[axis] + hi * scale[axis] < childMax[axis]) ++hi;
+			node.lo[axis][i] = static_cast<uint8_t>(lo);
+			node.hi[axis][i] = static_cast<uint8_t>(hi);
+		}
+
+		if (child.left < 0)
+		{
+			node.child[i] = child.first;
+			node.itemCount[i] = static_cast<uint8_t>(child.count);
+		}
+	}
+	m_nodes[index] = node;
+
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		if (nodes[children[i]].left >= 0)
+		{
+			uint32_t childIndex = Collapse(nodes, children[i]);
+			m_nodes[index].child[i] = childIndex;
+		}
+	}
+	return index;
+}
+
+BVHPrimitives::BVHPrimitives(std::vector<std::unique_ptr<Primitive>> &&prims)
+{
+	std::vector<std::unique_ptr<Primitive>> bounded;
+	std::vector<AABB> bounds;
+	for (auto &primitive : prims)
+	{
+		AABB b = primitive->GetBounds();
+		if (b.IsFinite())
+		{
+			bounds.push_back(b);
+			bounded.push_back(std::move(primitive));
+		}
+		else
+		{
+			m_unbounded.push_back(std::move(primitive));
+		}
+	}
+
+	std::vector<uint32_t> order = m_bvh.Build(bounds);
+	m_primitives.reserve(order.size());
+	for (uint32_t i : order)
+	{
+		m_primitives.push_back(std::move(bounded[i]));
+	}
+}
+
+BVHPrimitives::~BVHPrimitives()
+{
+}
+
+bool BVHPrimitives::Intersect(const Ray &r, Hit *hit) const
+{
+	bool result = false;
+	for (auto &primitive : m_unbounded)
+	{
+		if (primitive->Intersect(r, hit))
+		{
+			result = true;
+		}
+	}
+	if (m_bvh.Traverse(r, [&](uint32_t item) { return m_primitives[item]->Intersect(r, hit); }))
+	{
+		result = true;
+	}
+	return result;
+}
+
+bool BVHPrimitives::Occluded(const Ray &r, const Primitive **occluder) const
+{
+	for (auto &primitive : m_unbounded)
+	{
+		if (primitive->Occluded(r, occluder)) return true;
+	}
+	return m_bvh.Occluded(r, [&](uint32_t item) { return m_primitives[item]->Occluded(r, occluder); });
+}
+
+std::unique_ptr<Primitive> BVHPrimitives::Clone() const
+{
+	// the primitives are already in leaf order, copying the nodes is enough
+	std::unique_ptr<BVHPrimitives> clone(new BVHPrimitives());
+	clone->m_bvh = m_bvh;
+	for (auto &primitive : m_primitives)
+	{
+		clone->m_primitives.push_back(primitive->Clone());
+	}
+	for (auto &primitive : m_unbounded)
+	{
+		clone->m_unbounded.push_back(primitive->Clone());
+	}
+	return clone;
+}
+
+AABB BVHPrimitives::GetBounds() const
+{
+	return m_unbounded.empty() ? m_bvh.GetBounds() : AABB::Infinite();
+}
+
+size_t BVHPrimitives::GetMemoryBytes() const
+{
+	size_t bytes = sizeof(*this) + m_bvh.GetMemoryBytes()
+		+ (m_primitives.capacity() + m_unbounded.capacity()) * sizeof(std::unique_ptr<Primitive>);
+	for (auto &primitive : m_primitives)
+	{
+		bytes += primitive->GetMemoryBytes();
+	}
+	for (auto &primitive : m_unbounded)
+	{
+		bytes += primitive->GetMemoryBytes();
+	}
+	return bytes;
+}
+
+size_t BVHPrimitives::GetPrimitiveCount() const
+{
+	size_t count = 0;
+	for (auto &primitive : m_primitives)
+	{
+		count += primitive->GetPrimitiveCount();
+	}
+	for (auto &primitive : m_unbounded)
+	{
+		count += primitive->GetPrimitiveCount();
+	}
+	return count;
+}
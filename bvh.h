@@ -0,0 +1,213 @@
+#pragma once
+
+#include "bounds.h"
+#include "primitive.h"
+#include "ray.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Four-wide BVH node in one cache line. Child boxes are stored as 8 bit offsets on a per-axis
+// power of two grid spanning the node, they always enclose the exact child bounds.
+struct CompressedBVHNode
+{
+	float origin[3];
+	int8_t exponent[3];
+	uint8_t childCount;
+	uint8_t lo[3][4]; // axis major so the four children of an axis decode together
+	uint8_t hi[3][4];
+	uint32_t child[4]; // node index, or first item of a leaf
+	uint8_t itemCount[4]; // 0 for inner children
+	uint32_t padding;
+};
+
+static_assert(sizeof(CompressedBVHNode) == 64, "CompressedBVHNode should fill a cache line");
+
+// 2^exponent built straight from the float bits, exponent has to stay within [-126, 127].
+inline float exponentScale(int exponent)
+{
+	uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+	float scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+// Index structure over anything with bounds. Build returns the order the items have to be stored
+// in, leaves refer to contiguous ranges of that order.
+class CompressedBVH
+{
+public:
+	static const int maxLeafSize = 4;
+
+	// leafSize trades nodes for items per leaf, it has to stay below 256.
+	std::vector<uint32_t> Build(const std::vector<AABB> &bounds, int leafSize = maxLeafSize);
+
+	// Calls intersect(item) for the items of every leaf the ray reaches, nearest children first.
+	// intersect returns true on a hit and is expected to shorten ray.tMax.
+	template<typename F>
+	bool Traverse(const Ray &ray, F &&intersect) const;
+	// Calls occluded(item) for the items of the leaves the ray reaches until one returns true, in
+	// no particular order. ray.tMax stays as it is.
+	template<typename F>
+	bool Occluded(const Ray &ray, F &&occluded) const;
+
+	const AABB &GetBounds() const { return m_bounds; }
+	size_t GetNodeCount() const { return m_nodes.size(); }
+	size_t GetMemoryBytes() const { return m_nodes.size() * sizeof(CompressedBVHNode); }
+
+private:
+	struct BuildNode
+	{
+		AABB bounds;
+		int left = -1;
+		int right = -1;
+		uint32_t first = 0;
+		uint32_t count = 0;
+	};
+
+	int BuildBinary(const std::vector<AABB> &bounds, const std::vector<vector3> &centroids, std::vector<uint32_t> &order,
+		uint32_t first, uint32_t count, int depth, std::vector<BuildNode> &nodes) const;
+	uint32_t Collapse(const std::vector<BuildNode> &nodes, int binary);
+	// Bit per child box the ray overlaps within [0, tMax], tNear receives the entry distances.
+	static int IntersectChildren(const CompressedBVHNode &node, const vfloat4 origin[3], const vfloat4 rcpDirection[3], float tMax, vfloat4 *tNear);
+
+	std::vector<CompressedBVHNode> m_nodes;
+	AABB m_bounds;
+	int m_leafSize = maxLeafSize;
+};
+
+template<typename F>
+bool CompressedBVH::Traverse(const Ray &ray, F &&intersect) const
+{
+	if (m_nodes.empty()) return false;
+
+	const vfloat4 origin[3] = { vfloat4(ray.origin.x), vfloat4(ray.origin.y), vfloat4(ray.origin.z) };
+	const vfloat4 rcpDirection[3] = { vfloat4(1.0f / ray.direction.x), vfloat4(1.0f / ray.direction.y), vfloat4(1.0f / ray.direction.z) };
+
+	uint32_t stack[256];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	bool hit = false;
+
+	while (stackSize > 0)
+	{
+		const CompressedBVHNode &node = m_nodes[stack[--stackSize]];
+
+		vfloat4 tNear;
+		int mask = IntersectChildren(node, origin, rcpDirection, ray.tMax, &tNear);
+		if (!mask) continue;
+
+		// closest children first: leaves are intersected right away, inner nodes pushed far to near
+		float distance[4];
+		tNear.Store(distance);
+		int order[4];
+		int count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (!(mask & (1 << i))) continue;
+			int j = count++;
+			for (; j > 0 && distance[order[j - 1]] > distance[i]; --j)
+			{
+				order[j] = order[j - 1];
+			}
+			order[j] = i;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			int c = order[i];
+			if (node.itemCount[c] == 0) continue;
+			for (uint32_t item = node.child[c]; item < node.child[c] + node.itemCount[c]; ++item)
+			{
+				if (intersect(item)) hit = true;
+			}
+		}
+		for (int i = count - 1; i >= 0; --i)
+		{
+			int c = order[i];
+			if (node.itemCount[c] == 0) stack[stackSize++] = node.child[c];
+		}
+	}
+	return hit;
+}
+
+inline int CompressedBVH::IntersectChildren(const CompressedBVHNode &node, const vfloat4 origin[3], const vfloat4 rcpDirection[3], float tMax, vfloat4 *tNear)
+{
+	vfloat4 tEnter(0.0f);
+	vfloat4 tExit(tMax);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const vfloat4 scale(exponentScale(node.exponent[axis]));
+		const vfloat4 lo = vfloat4(node.origin[axis]) + vfloat4(node.lo[axis][0], node.lo[axis][1], node.lo[axis][2], node.lo[axis][3]) * scale;
+		const vfloat4 hi = vfloat4(node.origin[axis]) + vfloat4(node.hi[axis][0], node.hi[axis][1], node.hi[axis][2], node.hi[axis][3]) * scale;
+		const vfloat4 t0 = (lo - origin[axis]) * rcpDirection[axis];
+		const vfloat4 t1 = (hi - origin[axis]) * rcpDirection[axis];
+		tEnter = max(tEnter, min(t0, t1));
+		tExit = min(tExit, max(t0, t1));
+	}
+	*tNear = tEnter;
+	return lessEqualMask(tEnter, tExit) & ((1 << node.childCount) - 1);
+}
+
+template<typename F>
+bool CompressedBVH::Occluded(const Ray &ray, F &&occluded) const
+{
+	if (m_nodes.empty()) return false;
+
+	const vfloat4 origin[3] = { vfloat4(ray.origin.x), vfloat4(ray.origin.y), vfloat4(ray.origin.z) };
+	const vfloat4 rcpDirection[3] = { vfloat4(1.0f / ray.direction.x), vfloat4(1.0f / ray.direction.y), vfloat4(1.0f / ray.direction.z) };
+
+	uint32_t stack[256];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const CompressedBVHNode &node = m_nodes[stack[--stackSize]];
+
+		vfloat4 tNear;
+		int mask = IntersectChildren(node, origin, rcpDirection, ray.tMax, &tNear);
+		// any hit will do, leaves are tested as soon as they are reached and nothing is sorted
+		for (int c = 0; mask; ++c, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+			if (node.itemCount[c] == 0)
+			{
+				stack[stackSize++] = node.child[c];
+				continue;
+			}
+			for (uint32_t item = node.child[c]; item < node.child[c] + node.itemCount[c]; ++item)
+			{
+				if (occluded(item)) return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Scene aggregate backed by a CompressedBVH. Unbounded primitives such as planes are kept in a
+// separate list and tested against every ray.
+class BVHPrimitives: public Primitive
+{
+public:
+	BVHPrimitives(std::vector<std::unique_ptr<Primitive>> &&prims);
+	~BVHPrimitives() override;
+	bool Intersect(const Ray &r, Hit *hit) const override;
+	bool Occluded(const Ray &r, const Primitive **occluder) const override;
+	Material *GetMaterial() const override { return nullptr; }
+	std::unique_ptr<Primitive> Clone() const override;
+	AABB GetBounds() const override;
+	size_t GetMemoryBytes() const override;
+	size_t GetPrimitiveCount() const override;
+
+private:
+	BVHPrimitives() {}
+
+	CompressedBVH m_bvh;
+	std::vector<std::unique_ptr<Primitive>> m_primitives; // in BVH leaf order
+	std::vector<std::unique_ptr<Primitive>> m_unbounded;
+};
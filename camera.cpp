@@ -0,0 +1,21 @@
+#include "camera.h"
+
+#include <cmath>
+
+Camera::Camera(vector3 origin_, float fov, int imageW_, int imageH_): origin(origin_), imageW(imageW_), imageH(imageH_)
+{
+	float aspect = static_cast<float>(imageW) / static_cast<float>(imageH);
+	filmW = std::tan(fov / 2.0f * pi / 180.0f) * aspect;
+	filmH = std::tan(fov / 2.0f * pi / 180.0f);
+}
+
+Ray Camera::GenerateRay(float x, float y) const
+{
+	float filmX = (2.0f * x / imageW - 1.0f) * filmW;
+	float filmY = (1.0f - 2.0f * y / imageH) * filmH;
+	float filmZ = -1.0f;
+	vector3 filmDir(filmX, filmY, filmZ);
+	Ray ray(origin, filmDir.normalized());
+	ray.coneSpread = 2.0f * filmH / imageH; // one pixel
+	return ray;
+}
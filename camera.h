@@ -0,0 +1,19 @@
+#pragma once
+
+#include "math.h"
+#include "ray.h"
+
+// Pinhole camera looking down -z, fov is the vertical field of view in degrees.
+class Camera
+{
+public:
+	Camera(vector3 origin, float fov, int imageW, int imageH);
+	// x and y are in pixels, measured from the top-left corner of the image.
+	Ray GenerateRay(float x, float y) const;
+
+	vector3 origin;
+	int imageW;
+	int imageH;
+	float filmW;
+	float filmH;
+};
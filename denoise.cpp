@@ -0,0 +1,178 @@
+#include "denoise.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+static const float albedoEpsilon = 1e-3f;
+
+static float squaredDistance(const float *a, const float *b)
+{
+	float dx = a[0] - b[0];
+	float dy = a[1] - b[1];
+	float dz = a[2] - b[2];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+// color distance is measured on compressed values so that fireflies do not dominate the weight
+static float compressedDistance(const float *a, const float *b)
+{
+	float dx = a[0] / (1.0f + a[0]) - b[0] / (1.0f + b[0]);
+	float dy = a[1] / (1.0f + a[1]) - b[1] / (1.0f + b[1]);
+	float dz = a[2] / (1.0f + a[2]) - b[2] / (1.0f + b[2]);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static void atrousPass(const float *input, const FeatureBuffers &features, int width, int height,
+	int step, float colorSigma, const DenoiseSettings &settings, int x1, int y1, int x2, int y2, float *output)
+{
+	const float rcpColor = 1.0f / (colorSigma * colorSigma);
+	const float rcpNormal = 1.0f / (settings.normalSigma * settings.normalSigma);
+	const float rcpAlbedo = 1.0f / (settings.albedoSigma * settings.albedoSigma);
+
+	for (int y = y1; y < y2; ++y)
+	{
+		for (int x = x1; x < x2; ++x)
+		{
+			int p = y * width + x;
+			const float *cp = &input[p * 3];
+			const float *np = &features.normal[p * 3];
+			const float *ap = &features.albedo[p * 3];
+			float dp = features.depth[p];
+			float rcpDepth = 1.0f / std::max(1e-4f, settings.depthSigma * settings.depthSigma * dp * dp);
+
+			float sum[3] = { 0.0f, 0.0f, 0.0f };
+			float weightSum = 0.0f;
+
+			for (int j = -2; j <= 2; ++j)
+			{
+				int qy = y + j * step;
+				if (qy < 0 || qy >= height) continue;
+				for (int i = -2; i <= 2; ++i)
+				{
+					int qx = x + i * step;
+					if (qx < 0 || qx >= width) continue;
+
+					int q = qy * width + qx;
+					const float *cq = &input[q * 3];
+					float dq = features.depth[q];
+
+					float w = kernel[std::abs(i)] * kernel[std::abs(j)];
+					float e = compressedDistance(cp, cq) * rcpColor
+						+ squaredDistance(np, &features.normal[q * 3]) * rcpNormal
+						+ squaredDistance(ap, &features.albedo[q * 3]) * rcpAlbedo
+						+ (dp - dq) * (dp - dq) * rcpDepth;
+					w *= std::exp(-e);
+
+					sum[0] += cq[0] * w;
+					sum[1] += cq[1] * w;
+					sum[2] += cq[2] * w;
+					weightSum += w;
+				}
+			}
+
+			// the center tap always contributes, so weightSum never reaches zero
+			float rcpWeight = 1.0f / weightSum;
+			output[p * 3 + 0] = sum[0] * rcpWeight;
+			output[p * 3 + 1] = sum[1] * rcpWeight;
+			output[p * 3 + 2] = sum[2] * rcpWeight;
+		}
+	}
+}
+
+Denoiser::Denoiser(const float *color, const FeatureBuffers &features, int width, int height, const DenoiseSettings &settings, float *output)
+	: m_color(color)
+	, m_features(features)
+	, m_width(width)
+	, m_height(height)
+	, m_settings(settings)
+	, m_output(output)
+	, m_ping(width * height * 3)
+	, m_pong(width * height * 3)
+{
+	m_settings.iterations = std::max(0, m_settings.iterations);
+	m_settings.tileSize = std::max(1, m_settings.tileSize);
+	m_tileCountX = (width + m_settings.tileSize - 1) / m_settings.tileSize;
+	m_tileCountY = (height + m_settings.tileSize - 1) / m_settings.tileSize;
+}
+
+void Denoiser::RunTile(int pass, int tile)
+{
+	const int x1 = (tile % m_tileCountX) * m_settings.tileSize;
+	const int y1 = (tile / m_tileCountX) * m_settings.tileSize;
+	const int x2 = std::min(x1 + m_settings.tileSize, m_width);
+	const int y2 = std::min(y1 + m_settings.tileSize, m_height);
+
+	const int iteration = pass - 1;
+	if (pass == 0)
+	{
+		// filter untextured illumination, a single NaN or negative sample would otherwise bleed over the whole kernel footprint
+		for (int y = y1; y < y2; ++y)
+		{
+			for (int x = x1; x < x2; ++x)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					int i = (y * m_width + x) * 3 + c;
+					float illum = m_color[i] / std::max(albedoEpsilon, m_features.albedo[i]);
+					m_ping[i] = std::isfinite(illum) ? std::max(0.0f, illum) : 0.0f;
+				}
+			}
+		}
+	}
+	else if (iteration < m_settings.iterations)
+	{
+		const std::vector<float> &input = iteration % 2 == 0 ? m_ping : m_pong;
+		std::vector<float> &output = iteration % 2 == 0 ? m_pong : m_ping;
+		const float colorSigma = std::ldexp(m_settings.colorSigma, -iteration);
+		atrousPass(input.data(), m_features, m_width, m_height, 1 << iteration, colorSigma, m_settings, x1, y1, x2, y2, output.data());
+	}
+	else
+	{
+		// the a-trous passes alternate between the buffers, after an odd count the result is in pong
+		const std::vector<float> &result = m_settings.iterations % 2 == 0 ? m_ping : m_pong;
+		for (int y = y1; y < y2; ++y)
+		{
+			for (int x = x1; x < x2; ++x)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					int i = (y * m_width + x) * 3 + c;
+					m_output[i] = result[i] * std::max(albedoEpsilon, m_features.albedo[i]);
+				}
+			}
+		}
+	}
+}
+
+void Denoise(const float *color, const FeatureBuffers &features, int width, int height,
+	const DenoiseSettings &settings, int threadCount, float *output)
+{
+	Denoiser denoiser(color, features, width, height, settings, output);
+	threadCount = std::max(1, threadCount);
+
+	for (int pass = 0; pass < denoiser.GetPassCount(); ++pass)
+	{
+		std::atomic<int> nextTile = 0;
+		auto worker = [&]()
+		{
+			for (int tile = nextTile++; tile < denoiser.GetTileCount(); tile = nextTile++)
+			{
+				denoiser.RunTile(pass, tile);
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 1; i < threadCount; ++i)
+		{
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (auto &t : workers)
+		{
+			t.join();
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+// Per-pixel guide features gathered from the first hit of every camera sample.
+// All buffers are scanline ordered, albedo and normal hold 3 floats per pixel, depth holds 1.
+class FeatureBuffers
+{
+public:
+	FeatureBuffers(int width, int height)
+		: albedo(width * height * 3)
+		, normal(width * height * 3)
+		, depth(width * height)
+		{}
+
+	std::vector<float> albedo;
+	std::vector<float> normal;
+	std::vector<float> depth;
+};
+
+class DenoiseSettings
+{
+public:
+	int iterations = 5; // a-trous passes, the filter footprint doubles with every pass
+	float colorSigma = 0.6f;
+	float normalSigma = 0.2f;
+	float albedoSigma = 0.1f;
+	float depthSigma = 0.05f; // relative to the depth of the center pixel
+	int tileSize = 32;
+};
+
+// Denoise split into passes of tiles, for callers that bring their own threads. The tiles of a pass
+// may run concurrently and in any order, a pass may only start once the previous one has finished.
+// The buffers are only referenced and have to outlive the denoiser.
+class Denoiser
+{
+public:
+	Denoiser(const float *color, const FeatureBuffers &features, int width, int height, const DenoiseSettings &settings, float *output);
+
+	int GetPassCount() const { return m_settings.iterations + 2; }
+	int GetTileCount() const { return m_tileCountX * m_tileCountY; }
+	void RunTile(int pass, int tile);
+
+private:
+	const float *m_color;
+	const FeatureBuffers &m_features;
+	int m_width;
+	int m_height;
+	DenoiseSettings m_settings;
+	float *m_output;
+	int m_tileCountX;
+	int m_tileCountY;
+	std::vector<float> m_ping;
+	std::vector<float> m_pong;
+};
+
+// Edge-avoiding a-trous filter (joint bilateral with a sparse, widening kernel) guided by the
+// feature buffers. Illumination is demodulated by albedo before filtering so texture detail survives.
+// color and output are scanline ordered RGB, output may not alias color.
+void Denoise(const float *color, const FeatureBuffers &features, int width, int height,
+	const DenoiseSettings &settings, int threadCount, float *output);
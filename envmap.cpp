@@ -0,0 +1,268 @@
+#include "envmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+bool ReadPFM(const std::string &path, int *width, int *height, std::vector<float> *rgb)
+{
+	std::ifstream f(path, std::ifstream::binary);
+	if (!f) return false;
+
+	std::string magic;
+	float scale;
+	f >> magic >> *width >> *height >> scale;
+	f.get(); // the single whitespace character ending the header
+	if (!f || (magic != "PF" && magic != "Pf") || *width <= 0 || *height <= 0) return false;
+
+	const int channels = magic == "PF" ? 3 : 1;
+	std::vector<float> data(static_cast<size_t>(*width) * *height * channels);
+	f.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float));
+	if (!f) return false;
+
+	// negative scale means little endian data
+	const uint16_t probe = 1;
+	const bool hostLittleEndian = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+	if ((scale < 0.0f) != hostLittleEndian)
+	{
+		for (float &v : data)
+		{
+			uint8_t *bytes = reinterpret_cast<uint8_t *>(&v);
+			std::swap(bytes[0], bytes[3]);
+			std::swap(bytes[1], bytes[2]);
+		}
+	}
+
+	// scanlines are stored bottom to top
+	rgb->resize(static_cast<size_t>(*width) * *height * 3);
+	for (int y = 0; y < *height; ++y)
+	{
+		const float *row = &data[static_cast<size_t>(*height - 1 - y) * *width * channels];
+		for (int x = 0; x < *width; ++x)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				(*rgb)[(static_cast<size_t>(y) * *width + x) * 3 + c] = row[x * channels + (channels == 3 ? c : 0)];
+			}
+		}
+	}
+	return true;
+}
+
+bool WritePFM(const std::string &path, int width, int height, const float *rgb)
+{
+	std::ofstream f(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!f) return false;
+
+	const uint16_t probe = 1;
+	const bool hostLittleEndian = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+	f << "PF\n" << width << " " << height << "\n" << (hostLittleEndian ? "-1.0" : "1.0") << "\n";
+	for (int y = height - 1; y >= 0; --y)
+	{
+		f.write(reinterpret_cast<const char *>(rgb + static_cast<size_t>(y) * width * 3), width * 3 * sizeof(float));
+	}
+	return static_cast<bool>(f);
+}
+
+// header of the .cdf file next to a map, the source size and time detect stale tables
+struct EnvironmentTableHeader
+{
+	char magic[4];
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+};
+
+static float luminance(const float *rgb)
+{
+	return 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+}
+
+// Continuous sample of a piecewise constant distribution given its normalized CDF of n + 1 entries.
+static int sampleCdf(const float *cdf, int n, float u, float *offset)
+{
+	int i = static_cast<int>(std::upper_bound(cdf, cdf + n + 1, u) - cdf) - 1;
+	i = std::min(std::max(i, 0), n - 1);
+	float width = cdf[i + 1] - cdf[i];
+	*offset = width > 0.0f ? clamp((u - cdf[i]) / width, 0.0f, 1.0f) : 0.5f;
+	return i;
+}
+
+EnvironmentMap::EnvironmentMap(int width, int height, std::vector<float> &&rgb, float strength)
+	: EnvironmentMap(width, height, std::move(rgb), strength, true)
+{
+}
+
+EnvironmentMap::EnvironmentMap(int width, int height, std::vector<float> &&rgb, float strength, bool buildTables)
+	: m_width(width)
+	, m_height(height)
+	, m_strength(strength)
+	, m_rgb(std::move(rgb))
+{
+	if (buildTables)
+	{
+		BuildTables();
+	}
+}
+
+std::unique_ptr<EnvironmentMap> EnvironmentMap::Load(const std::string &path, float strength)
+{
+	int width;
+	int height;
+	std::vector<float> rgb;
+	if (!ReadPFM(path, &width, &height, &rgb)) return nullptr;
+
+	std::error_code error;
+	uint64_t sourceSize = std::filesystem::file_size(path, error);
+	int64_t sourceTime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+
+	std::unique_ptr<EnvironmentMap> map(new EnvironmentMap(width, height, std::move(rgb), strength, false));
+	const std::string tablePath = path + ".cdf";
+	if (!map->ReadTables(tablePath, sourceSize, sourceTime))
+	{
+		map->BuildTables();
+		// a read-only location only costs the rebuild next time
+		map->WriteTables(tablePath, sourceSize, sourceTime);
+	}
+	return map;
+}
+
+void EnvironmentMap::BuildTables()
+{
+	const int w = m_width;
+	const int h = m_height;
+	m_conditionalCdf.assign(static_cast<size_t>(h) * (w + 1), 0.0f);
+	m_marginalCdf.assign(h + 1, 0.0f);
+
+	for (int y = 0; y < h; ++y)
+	{
+		// rows near the poles cover less solid angle
+		float sinTheta = std::sin(pi * (y + 0.5f) / h);
+		float *cdf = &m_conditionalCdf[static_cast<size_t>(y) * (w + 1)];
+		for (int x = 0; x < w; ++x)
+		{
+			float f = std::max(0.0f, luminance(&m_rgb[(static_cast<size_t>(y) * w + x) * 3])) * sinTheta;
+			cdf[x + 1] = cdf[x] + f / w;
+		}
+		float rowIntegral = cdf[w];
+		for (int x = 1; x <= w; ++x)
+		{
+			cdf[x] = rowIntegral > 0.0f ? cdf[x] / rowIntegral : static_cast<float>(x) / w;
+		}
+		m_marginalCdf[y + 1] = m_marginalCdf[y] + rowIntegral / h;
+	}
+
+	m_integral = m_marginalCdf[h];
+	for (int y = 1; y <= h; ++y)
+	{
+		m_marginalCdf[y] = m_integral > 0.0f ? m_marginalCdf[y] / m_integral : static_cast<float>(y) / h;
+	}
+}
+
+bool EnvironmentMap::ReadTables(const std::string &path, uint64_t sourceSize, int64_t sourceTime)
+{
+	std::ifstream f(path, std::ifstream::binary);
+	if (!f) return false;
+
+	EnvironmentTableHeader header;
+	f.read(reinterpret_cast<char *>(&header), sizeof(header));
+	if (!f || std::memcmp(header.magic, "RTE1", 4) != 0 || header.width != static_cast<uint32_t>(m_width)
+		|| header.height != static_cast<uint32_t>(m_height) || header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+	{
+		return false;
+	}
+
+	m_conditionalCdf.resize(static_cast<size_t>(m_height) * (m_width + 1));
+	m_marginalCdf.resize(m_height + 1);
+	f.read(reinterpret_cast<char *>(m_conditionalCdf.data()), m_conditionalCdf.size() * sizeof(float));
+	f.read(reinterpret_cast<char *>(m_marginalCdf.data()), m_marginalCdf.size() * sizeof(float));
+	f.read(reinterpret_cast<char *>(&m_integral), sizeof(m_integral));
+	return static_cast<bool>(f);
+}
+
+bool EnvironmentMap::WriteTables(const std::string &path, uint64_t sourceSize, int64_t sourceTime) const
+{
+	std::ofstream f(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!f) return false;
+
+	EnvironmentTableHeader header;
+	std::memcpy(header.magic, "RTE1", 4);
+	header.width = m_width;
+	header.height = m_height;
+	header.reserved = 0;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	f.write(reinterpret_cast<const char *>(m_conditionalCdf.data()), m_conditionalCdf.size() * sizeof(float));
+	f.write(reinterpret_cast<const char *>(m_marginalCdf.data()), m_marginalCdf.size() * sizeof(float));
+	f.write(reinterpret_cast<const char *>(&m_integral), sizeof(m_integral));
+	return static_cast<bool>(f);
+}
+
+void EnvironmentMap::DirectionToPixel(const vector3 &direction, int *x, int *y, float *sinTheta) const
+{
+	float cosTheta = clamp(direction.y, -1.0f, 1.0f);
+	float u = 0.5f + std::atan2(direction.x, -direction.z) * 0.5f * rcpPi;
+	float v = std::acos(cosTheta) * rcpPi;
+	*x = std::min(std::max(static_cast<int>(u * m_width), 0), m_width - 1);
+	*y = std::min(std::max(static_cast<int>(v * m_height), 0), m_height - 1);
+	*sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+}
+
+vector3 EnvironmentMap::Evaluate(const vector3 &direction) const
+{
+	int x;
+	int y;
+	float sinTheta;
+	DirectionToPixel(direction, &x, &y, &sinTheta);
+	const float *rgb = &m_rgb[(static_cast<size_t>(y) * m_width + x) * 3];
+	return vector3(rgb[0], rgb[1], rgb[2]) * m_strength;
+}
+
+vector3 EnvironmentMap::Sample(float e0, float e1, vector3 *direction, float *pdf) const
+{
+	if (m_integral <= 0.0f)
+	{
+		*pdf = 0.0f;
+		return vector3();
+	}
+
+	float dv;
+	float du;
+	int y = sampleCdf(m_marginalCdf.data(), m_height, e0, &dv);
+	int x = sampleCdf(&m_conditionalCdf[static_cast<size_t>(y) * (m_width + 1)], m_width, e1, &du);
+
+	float theta = pi * (y + dv) / m_height;
+	float phi = 2.0f * pi * ((x + du) / m_width - 0.5f);
+	float sinTheta = std::sin(theta);
+	*direction = vector3(sinTheta * std::sin(phi), std::cos(theta), -sinTheta * std::cos(phi));
+
+	// pdf over the unit square is the normalized table weight, the lat-long mapping stretches it by 2 pi^2 sin theta
+	const float *rgb = &m_rgb[(static_cast<size_t>(y) * m_width + x) * 3];
+	float weight = std::max(0.0f, luminance(rgb)) * std::sin(pi * (y + 0.5f) / m_height);
+	*pdf = sinTheta > 0.0f ? weight / (m_integral * 2.0f * pi * pi * sinTheta) : 0.0f;
+	return vector3(rgb[0], rgb[1], rgb[2]) * m_strength;
+}
+
+float EnvironmentMap::Pdf(const vector3 &direction) const
+{
+	if (m_integral <= 0.0f) return 0.0f;
+
+	int x;
+	int y;
+	float sinTheta;
+	DirectionToPixel(direction, &x, &y, &sinTheta);
+	if (sinTheta <= 0.0f) return 0.0f;
+
+	float weight = std::max(0.0f, luminance(&m_rgb[(static_cast<size_t>(y) * m_width + x) * 3])) * std::sin(pi * (y + 0.5f) / m_height);
+	return weight / (m_integral * 2.0f * pi * pi * sinTheta);
+}
+
+size_t EnvironmentMap::GetMemoryBytes() const
+{
+	return sizeof(*this) + (m_rgb.capacity() + m_conditionalCdf.capacity() + m_marginalCdf.capacity()) * sizeof(float);
+}
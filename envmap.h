@@ -0,0 +1,50 @@
+#pragma once
+
+#include "math.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reads a portable float map, RGB or grayscale, into top to bottom scanline ordered RGB.
+bool ReadPFM(const std::string &path, int *width, int *height, std::vector<float> *rgb);
+bool WritePFM(const std::string &path, int width, int height, const float *rgb);
+
+// HDR environment in latitude-longitude layout, +y is up and the center of the image looks down -z.
+// Radiance is constant over a pixel, which is exactly what the 2D sampling distribution (a marginal
+// CDF over rows and a conditional CDF per row, weighted by luminance and sin theta) reproduces.
+class EnvironmentMap
+{
+public:
+	// rgb is scanline ordered linear radiance, strength scales all of it.
+	EnvironmentMap(int width, int height, std::vector<float> &&rgb, float strength = 1.0f);
+
+	// Loads a PFM. The sampling tables are read from path + ".cdf" if that file matches the map,
+	// otherwise they are built and written there for the next run. Returns null if the map cannot be read.
+	static std::unique_ptr<EnvironmentMap> Load(const std::string &path, float strength = 1.0f);
+
+	vector3 Evaluate(const vector3 &direction) const;
+	// Samples a direction proportionally to the radiance, returns the radiance and the solid angle pdf.
+	vector3 Sample(float e0, float e1, vector3 *direction, float *pdf) const;
+	float Pdf(const vector3 &direction) const;
+
+	int GetWidth() const { return m_width; }
+	int GetHeight() const { return m_height; }
+	size_t GetMemoryBytes() const;
+
+private:
+	EnvironmentMap(int width, int height, std::vector<float> &&rgb, float strength, bool buildTables);
+	void BuildTables();
+	bool ReadTables(const std::string &path, uint64_t sourceSize, int64_t sourceTime);
+	bool WriteTables(const std::string &path, uint64_t sourceSize, int64_t sourceTime) const;
+	void DirectionToPixel(const vector3 &direction, int *x, int *y, float *sinTheta) const;
+
+	int m_width;
+	int m_height;
+	float m_strength;
+	std::vector<float> m_rgb;
+	std::vector<float> m_conditionalCdf; // m_height rows of m_width + 1 entries
+	std::vector<float> m_marginalCdf; // m_height + 1 entries
+	float m_integral = 0.0f; // mean weight over the image
+};
@@ -0,0 +1,364 @@
+#include "guiding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// quadrants holding more than this share of a leaf's energy get a finer level in the next pass
+static const float subdivideFraction = 0.01f;
+static const int maxDirectionalDepth = 20;
+static const float oneMinusEpsilon = 0.99999994f;
+
+// no fetch_add for atomic floats before C++20
+static void atomicAdd(std::atomic<float> &a, float value)
+{
+	float old = a.load(std::memory_order_relaxed);
+	while (!a.compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+// only writes when the bound grows, which soon becomes rare
+static void atomicMin(std::atomic<float> &a, float value)
+{
+	float old = a.load(std::memory_order_relaxed);
+	while (value < old && !a.compare_exchange_weak(old, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+static void atomicMax(std::atomic<float> &a, float value)
+{
+	float old = a.load(std::memory_order_relaxed);
+	while (value > old && !a.compare_exchange_weak(old, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+static float component(const vector3 &v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// cos theta and phi both map linearly to [0, 1), so areas in the square are proportional to solid angle
+static void directionToSquare(const vector3 &direction, float *u, float *v)
+{
+	float phi = std::atan2(direction.z, direction.x);
+	if (phi < 0.0f)
+	{
+		phi += 2.0f * pi;
+	}
+	*u = clamp((direction.y + 1.0f) * 0.5f, 0.0f, oneMinusEpsilon);
+	*v = clamp(phi * 0.5f * rcpPi, 0.0f, oneMinusEpsilon);
+}
+
+static vector3 squareToDirection(float u, float v)
+{
+	float cosTheta = 2.0f * u - 1.0f;
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * pi * v;
+	return vector3(sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi));
+}
+
+DirectionalQuadtree::Node::Node()
+{
+	for (int q = 0; q < 4; ++q)
+	{
+		energy[q].store(0.0f, std::memory_order_relaxed);
+		child[q] = 0;
+	}
+}
+
+DirectionalQuadtree::Node::Node(const Node &other)
+{
+	*this = other;
+}
+
+DirectionalQuadtree::Node &DirectionalQuadtree::Node::operator=(const Node &other)
+{
+	for (int q = 0; q < 4; ++q)
+	{
+		energy[q].store(other.energy[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		child[q] = other.child[q];
+	}
+	return *this;
+}
+
+DirectionalQuadtree::DirectionalQuadtree()
+	: m_nodes(1)
+{
+}
+
+float DirectionalQuadtree::GetTotal() const
+{
+	const Node &root = m_nodes[0];
+	float total = 0.0f;
+	for (int q = 0; q < 4; ++q)
+	{
+		total += root.energy[q].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void DirectionalQuadtree::Record(const vector3 &direction, float value)
+{
+	float u;
+	float v;
+	directionToSquare(direction, &u, &v);
+	uint32_t node = 0;
+	while (true)
+	{
+		int x = u >= 0.5f ? 1 : 0;
+		int y = v >= 0.5f ? 1 : 0;
+		int q = x + 2 * y;
+		atomicAdd(m_nodes[node].energy[q], value);
+		node = m_nodes[node].child[q];
+		if (node == 0) return;
+		u = 2.0f * u - x;
+		v = 2.0f * v - y;
+	}
+}
+
+float DirectionalQuadtree::Sample(float e0, float e1, vector3 *direction) const
+{
+	float pdf = 1.0f;
+	float u = 0.0f;
+	float v = 0.0f;
+	float size = 1.0f;
+	uint32_t node = 0;
+	while (true)
+	{
+		const Node &n = m_nodes[node];
+		float e[4];
+		for (int q = 0; q < 4; ++q)
+		{
+			e[q] = n.energy[q].load(std::memory_order_relaxed);
+		}
+		float total = e[0] + e[1] + e[2] + e[3];
+		if (!(total > 0.0f)) break; // uniform over the rest of the node
+
+		// picks the column, then the quadrant in it, and rescales the random numbers for the next level
+		int x;
+		float left = e[0] + e[2];
+		if (e0 * total < left)
+		{
+			x = 0;
+			e0 = e0 * total / left;
+		}
+		else
+		{
+			x = 1;
+			e0 = (e0 * total - left) / (total - left);
+		}
+		int y;
+		float column = e[x] + e[x + 2];
+		if (e1 * column < e[x])
+		{
+			y = 0;
+			e1 = e1 * column / e[x];
+		}
+		else
+		{
+			y = 1;
+			e1 = (e1 * column - e[x]) / e[x + 2];
+		}
+		e0 = clamp(e0, 0.0f, oneMinusEpsilon);
+		e1 = clamp(e1, 0.0f, oneMinusEpsilon);
+
+		int q = x + 2 * y;
+		pdf *= 4.0f * e[q] / total;
+		size *= 0.5f;
+		u += x * size;
+		v += y * size;
+		if (n.child[q] == 0) break;
+		node = n.child[q];
+	}
+
+	*direction = squareToDirection(u + e0 * size, v + e1 * size);
+	return pdf * 0.25f * rcpPi;
+}
+
+float DirectionalQuadtree::Pdf(const vector3 &direction) const
+{
+	float u;
+	float v;
+	directionToSquare(direction, &u, &v);
+	float pdf = 1.0f;
+	uint32_t node = 0;
+	while (true)
+	{
+		const Node &n = m_nodes[node];
+		float total = 0.0f;
+		for (int q = 0; q < 4; ++q)
+		{
+			total += n.energy[q].load(std::memory_order_relaxed);
+		}
+		if (!(total > 0.0f)) break;
+
+		int x = u >= 0.5f ? 1 : 0;
+		int y = v >= 0.5f ? 1 : 0;
+		int q = x + 2 * y;
+		pdf *= 4.0f * n.energy[q].load(std::memory_order_relaxed) / total;
+		if (pdf <= 0.0f || n.child[q] == 0) break;
+		node = n.child[q];
+		u = 2.0f * u - x;
+		v = 2.0f * v - y;
+	}
+	return pdf * 0.25f * rcpPi;
+}
+
+void DirectionalQuadtree::Rebuild(const DirectionalQuadtree &source, float subdivideFraction, int maxDepth)
+{
+	m_nodes.assign(1, Node());
+	const float total = source.GetTotal();
+	RebuildNode(0, source, 0, total, total, subdivideFraction, 1, maxDepth);
+}
+
+void DirectionalQuadtree::RebuildNode(uint32_t node, const DirectionalQuadtree &source, int sourceNode, float quadrantEnergy, float total,
+	float subdivideFraction, int depth, int maxDepth)
+{
+	for (int q = 0; q < 4; ++q)
+	{
+		// below the resolution of the source its energy is assumed to spread evenly
+		const float energy = sourceNode >= 0 ? source.m_nodes[sourceNode].energy[q].load(std::memory_order_relaxed) : 0.25f * quadrantEnergy;
+		if (depth >= maxDepth || !(total > 0.0f) || energy <= total * subdivideFraction) continue;
+
+		const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.emplace_back();
+		m_nodes[node].child[q] = child;
+		const uint32_t sourceChild = sourceNode >= 0 ? source.m_nodes[sourceNode].child[q] : 0;
+		RebuildNode(child, source, sourceChild != 0 ? static_cast<int>(sourceChild) : -1, energy, total, subdivideFraction, depth + 1, maxDepth);
+	}
+}
+
+GuidingField::Leaf::Leaf()
+{
+	Reset();
+}
+
+void GuidingField::Leaf::Reset()
+{
+	count.store(0, std::memory_order_relaxed);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		positionMin[axis].store(std::numeric_limits<float>::infinity(), std::memory_order_relaxed);
+		positionMax[axis].store(-std::numeric_limits<float>::infinity(), std::memory_order_relaxed);
+	}
+}
+
+GuidingField::GuidingField(int splitThreshold, int maxDepth)
+	: m_splitThreshold(splitThreshold)
+	, m_maxDepth(maxDepth)
+{
+	m_nodes.push_back({ -1, 0.0f, 0 });
+	m_leaves.push_back(std::make_unique<Leaf>());
+}
+
+GuidingField::~GuidingField()
+{
+}
+
+int GuidingField::FindLeaf(const vector3 &position) const
+{
+	int node = 0;
+	while (m_nodes[node].axis >= 0)
+	{
+		const Node &n = m_nodes[node];
+		node = component(position, n.axis) < n.split ? n.child : n.child + 1;
+	}
+	return m_nodes[node].child;
+}
+
+float GuidingField::Sample(int leaf, float e0, float e1, vector3 *direction) const
+{
+	return m_leaves[leaf]->sampling.Sample(e0, e1, direction);
+}
+
+float GuidingField::Pdf(int leaf, const vector3 &direction) const
+{
+	return m_leaves[leaf]->sampling.Pdf(direction);
+}
+
+void GuidingField::Record(int leaf, const vector3 &position, const vector3 &direction, float radiance, float pdf)
+{
+	if (!(radiance >= 0.0f) || !(pdf > 0.0f) || !std::isfinite(radiance / pdf)) return;
+
+	Leaf &l = *m_leaves[leaf];
+	l.recording.Record(direction, radiance / pdf);
+	l.count.fetch_add(1, std::memory_order_relaxed);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		atomicMin(l.positionMin[axis], component(position, axis));
+		atomicMax(l.positionMax[axis], component(position, axis));
+	}
+}
+
+void GuidingField::Refine()
+{
+	const size_t leafCount = m_leaves.size();
+	for (size_t i = 0; i < leafCount; ++i)
+	{
+		Leaf &leaf = *m_leaves[i];
+
+		// leaves nothing reached this pass keep what they learned before
+		if (leaf.recording.GetTotal() > 0.0f)
+		{
+			leaf.sampling = leaf.recording;
+			leaf.trained = true;
+		}
+		leaf.recording.Rebuild(leaf.sampling, subdivideFraction, maxDirectionalDepth);
+
+		const uint32_t count = leaf.count.load(std::memory_order_relaxed);
+		if (count > static_cast<uint32_t>(m_splitThreshold))
+		{
+			// the records' bounds, the first pass has no other idea where the scene is
+			AABB bounds(vector3(leaf.positionMin[0], leaf.positionMin[1], leaf.positionMin[2]),
+				vector3(leaf.positionMax[0], leaf.positionMax[1], leaf.positionMax[2]));
+			Split(static_cast<int>(i), bounds, count);
+		}
+		leaf.Reset();
+	}
+}
+
+void GuidingField::Split(int leafIndex, const AABB &bounds, uint32_t count)
+{
+	Leaf &leaf = *m_leaves[leafIndex];
+	if (count <= static_cast<uint32_t>(m_splitThreshold) || leaf.depth >= m_maxDepth) return;
+
+	// records are assumed to spread evenly, each half expects half of them
+	const int axis = bounds.LongestAxis();
+	const float split = component(bounds.Center(), axis);
+	AABB lower = bounds;
+	AABB upper = bounds;
+	if (axis == 0) { lower.max.x = split; upper.min.x = split; }
+	else if (axis == 1) { lower.max.y = split; upper.min.y = split; }
+	else { lower.max.z = split; upper.min.z = split; }
+
+	const int first = static_cast<int>(m_nodes.size());
+	const int siblingIndex = static_cast<int>(m_leaves.size());
+	std::unique_ptr<Leaf> sibling = std::make_unique<Leaf>();
+	sibling->node = first + 1;
+	sibling->depth = leaf.depth + 1;
+	sibling->trained = leaf.trained;
+	sibling->sampling = leaf.sampling;
+	sibling->recording = leaf.recording;
+	m_nodes[leaf.node] = { axis, split, first };
+	m_nodes.push_back({ -1, 0.0f, leafIndex });
+	m_nodes.push_back({ -1, 0.0f, siblingIndex });
+	m_leaves.push_back(std::move(sibling));
+	leaf.node = first;
+	leaf.depth++;
+
+	Split(leafIndex, lower, count / 2);
+	Split(siblingIndex, upper, count / 2);
+}
+
+size_t GuidingField::GetMemoryBytes() const
+{
+	size_t bytes = sizeof(*this) + m_nodes.capacity() * sizeof(Node) + m_leaves.capacity() * sizeof(std::unique_ptr<Leaf>);
+	for (const std::unique_ptr<Leaf> &leaf : m_leaves)
+	{
+		bytes += sizeof(Leaf) + (leaf->sampling.GetNodeCount() + leaf->recording.GetNodeCount()) * 4 * (sizeof(float) + sizeof(uint32_t));
+	}
+	return bytes;
+}
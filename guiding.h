@@ -0,0 +1,104 @@
+#pragma once
+
+#include "bounds.h"
+#include "math.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Distribution over the sphere of directions, stored as a quadtree over the equal-area square
+// (cos theta, phi) in world space. Every node keeps the energy of its four quadrants, so sampling
+// and pdf evaluation only walk down to the quadrant holding the direction.
+class DirectionalQuadtree
+{
+public:
+	DirectionalQuadtree();
+
+	float GetTotal() const;
+	// Thread safe, adds value to every quadrant containing direction.
+	void Record(const vector3 &direction, float value);
+	// Samples proportionally to the energies, returns the solid angle pdf.
+	float Sample(float e0, float e1, vector3 *direction) const;
+	float Pdf(const vector3 &direction) const;
+
+	// Replaces the tree by an empty one whose resolution follows the energies of source: quadrants
+	// holding more than subdivideFraction of its total are split, at most maxDepth levels deep.
+	void Rebuild(const DirectionalQuadtree &source, float subdivideFraction, int maxDepth);
+	size_t GetNodeCount() const { return m_nodes.size(); }
+
+private:
+	struct Node
+	{
+		Node();
+		Node(const Node &other);
+		Node &operator=(const Node &other);
+
+		std::atomic<float> energy[4]; // quadrant x + 2 * y
+		uint32_t child[4]; // 0 for quadrants without a node below them
+	};
+
+	void RebuildNode(uint32_t node, const DirectionalQuadtree &source, int sourceNode, float quadrantEnergy, float total,
+		float subdivideFraction, int depth, int maxDepth);
+
+	std::vector<Node> m_nodes;
+};
+
+// Learned distribution of incident radiance for path guiding. Space is split by a kd-tree whose
+// leaves hold a DirectionalQuadtree. Rendering passes Record() radiance into the leaves, lock free,
+// while both trees stay fixed; Refine() in between passes turns the recorded radiance into the
+// distributions that Sample() and Pdf() use, adapts the directional resolution to them and halves
+// busy leaves, around the bounds of their records, until every part can expect fewer records than
+// the threshold.
+class GuidingField
+{
+public:
+	// Leaves split once a pass records more than splitThreshold samples into them.
+	GuidingField(int splitThreshold = 4000, int maxDepth = 24);
+	~GuidingField();
+
+	int FindLeaf(const vector3 &position) const;
+	// False until a refinement gave the leaf a distribution to sample.
+	bool IsTrained(int leaf) const { return m_leaves[leaf]->trained; }
+	// Returns the solid angle pdf of the sampled direction.
+	float Sample(int leaf, float e0, float e1, vector3 *direction) const;
+	float Pdf(int leaf, const vector3 &direction) const;
+
+	// Thread safe. radiance is the incident radiance along direction, which was sampled with pdf.
+	void Record(int leaf, const vector3 &position, const vector3 &direction, float radiance, float pdf);
+	// Not thread safe, no Record() may run concurrently.
+	void Refine();
+
+	size_t GetLeafCount() const { return m_leaves.size(); }
+	size_t GetMemoryBytes() const;
+
+private:
+	struct Node
+	{
+		int axis; // split axis, -1 for leaves
+		float split;
+		int child; // first of two children, or the leaf index
+	};
+
+	struct Leaf
+	{
+		Leaf();
+		void Reset();
+
+		int node = 0;
+		int depth = 0;
+		bool trained = false;
+		DirectionalQuadtree sampling; // learned in the previous passes
+		DirectionalQuadtree recording; // radiance recorded during the current pass
+		std::atomic<uint32_t> count;
+		std::atomic<float> positionMin[3];
+		std::atomic<float> positionMax[3];
+	};
+
+	void Split(int leaf, const AABB &bounds, uint32_t count);
+
+	int m_splitThreshold;
+	int m_maxDepth;
+	std::vector<Node> m_nodes;
+	std::vector<std::unique_ptr<Leaf>> m_leaves;
+};
@@ -10,5 +10,8 @@ class Hit
 public:
 	vector3 position;
 	vector3 normal;
+	float u = 0.0f;
+	float v = 0.0f;
+	float uvDensity = 0.0f; // uv units per world unit around the hit, 0 if unknown
 	const Primitive *primitive = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,539 @@
+#include "integrator.h"
+#include "brdf.h"
+#include "bsdf.h"
+#include "camera.h"
+#include "envmap.h"
+#include "guiding.h"
+#include "hit.h"
+#include "material.h"
+#include "medium.h"
+#include "renderer.h"
+#include "sampling.h"
+#include "scene.h"
+
+#include <chrono>
+#include <limits>
+
+static const int maxBoundaryCrossings = 16;
+static const float boundaryOffset = 1e-4f;
+// share of the directions sampled from a trained guiding field, the rest come from the BSDF
+static const float guidingFraction = 0.5f;
+static const int maxGuidingVertices = 16;
+
+// ray cone spread a bounce adds, in radians; a glossy lobe adds about twice its alpha
+static const float diffuseConeSpread = 1.0f;
+
+// Continues the cone of ray from distance t along a new direction that blurs it by spread.
+static void continueCone(const Ray &ray, float t, float spread, float lodSpread, Ray *next)
+{
+	next->coneWidth = ray.GetFootprint(t);
+	next->coneSpread = ray.coneSpread + spread;
+	next->coarse = next->coneSpread > lodSpread;
+}
+
+static float average(const Spectrum &s, bool spectral)
+{
+	return spectral ? 0.25f * (s[0] + s[1] + s[2] + s[3]) : (s[0] + s[1] + s[2]) / 3.0f;
+}
+
+static float powerHeuristic(float pdf, float otherPdf)
+{
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Visibility of a light at distance along direction, scaled by the transmittance of the media in
+// between. Surfaces without a material are medium boundaries, the shadow ray crosses them.
+// lastOccluder is the light's entry in the OcclusionCache.
+static float shadowTransmittance(const Scene *scene, vector3 origin, vector3 direction, float distance, const Medium *medium,
+	const Primitive **lastOccluder, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis)
+{
+	if (!scene->HasMedia())
+	{
+		Ray ray(origin, direction);
+		ray.tMax = distance;
+		return scene->Occluded(ray, lastOccluder) ? 0.0f : 1.0f;
+	}
+
+	// an opaque surface anywhere on the segment blocks it whatever the media and boundaries before it
+	if (*lastOccluder)
+	{
+		Ray ray(origin, direction);
+		ray.tMax = distance;
+		if ((*lastOccluder)->Occluded(ray, nullptr)) return 0.0f;
+	}
+
+	float transmittance = 1.0f;
+	for (int crossing = 0; crossing < maxBoundaryCrossings; ++crossing)
+	{
+		Ray ray(origin, direction);
+		ray.tMax = distance;
+		Hit hit;
+		bool blocked = scene->Intersect(ray, &hit);
+		if (blocked && hit.primitive->GetMaterial())
+		{
+			*lastOccluder = hit.primitive;
+			return 0.0f;
+		}
+
+		// tMax is now the distance to the boundary or to the light
+		if (medium)
+		{
+			transmittance *= medium->Transmittance(ray, ray.tMax, gen, dis);
+		}
+		if (!blocked || transmittance <= 0.0f) return transmittance;
+
+		medium = direction.dot(hit.normal) < 0.0f ? hit.primitive->GetInterior() : scene->m_medium;
+		origin = hit.position + direction * boundaryOffset;
+		distance -= ray.tMax + boundaryOffset;
+	}
+	return 0.0f;
+}
+
+ShadowBatch::ShadowBatch(const Scene *scene, OcclusionCache *occlusion, GuidingField *guiding, SpectrumSum *pixels)
+	: m_scene(scene)
+	, m_occlusion(occlusion)
+	, m_guiding(guiding)
+	, m_pixels(pixels)
+{
+}
+
+void ShadowBatch::BeginPath(int pixel, const SampledWavelengths *wavelengths)
+{
+	Path &path = m_paths.emplace_back();
+	path.pixel = pixel;
+	path.spectral = wavelengths != nullptr;
+	if (wavelengths)
+	{
+		path.wavelengths = *wavelengths;
+	}
+	path.firstVertex = m_vertices.size();
+}
+
+void ShadowBatch::Add(int light, vector3 origin, vector3 direction, float distance, const Medium *medium, const Spectrum &contribution, int guidingVertexCount)
+{
+	// backfacing lights and the like would be traced for nothing
+	if (contribution[0] == 0.0f && contribution[1] == 0.0f && contribution[2] == 0.0f && contribution[3] == 0.0f) return;
+	const int slot = light == environment ? static_cast<int>(m_scene->m_lights.size()) : light;
+	m_rays.push_back({ origin, direction, distance, medium, contribution, static_cast<int>(m_paths.size()) - 1, slot, guidingVertexCount });
+}
+
+void ShadowBatch::AddGuidingVertex(int leaf, vector3 position, vector3 direction, float pdf, const Spectrum &radiance, const Spectrum &throughput)
+{
+	m_vertices.push_back({ leaf, position, direction, pdf, radiance, throughput });
+}
+
+void ShadowBatch::Flush(std::minstd_rand &gen, std::uniform_real_distribution<float> &dis)
+{
+	// counting sort by light, the rays of a light stay in the order the paths cast them
+	const size_t slotCount = m_occlusion->GetSlotCount();
+	m_slotStarts.assign(slotCount + 1, 0);
+	for (const ShadowRay &ray : m_rays)
+	{
+		m_slotStarts[ray.slot + 1]++;
+	}
+	for (size_t slot = 0; slot < slotCount; ++slot)
+	{
+		m_slotStarts[slot + 1] += m_slotStarts[slot];
+	}
+	m_order.resize(m_rays.size());
+	for (uint32_t i = 0; i < m_rays.size(); ++i)
+	{
+		m_order[m_slotStarts[m_rays[i].slot]++] = i;
+	}
+
+	for (uint32_t i : m_order)
+	{
+		const ShadowRay &ray = m_rays[i];
+		const Primitive **occluder = ray.slot < static_cast<int>(slotCount) - 1 ? m_occlusion->GetLight(ray.slot) : m_occlusion->GetEnvironment();
+		float transmittance = shadowTransmittance(m_scene, ray.origin, ray.direction, ray.distance, ray.medium, occluder, gen, dis);
+		if (transmittance <= 0.0f) continue;
+
+		const Path &path = m_paths[ray.path];
+		const Spectrum contribution = ray.contribution * transmittance;
+		if (m_pixels)
+		{
+			m_pixels[path.pixel].Add(path.spectral ? Spectrum(path.wavelengths.ToRGB(contribution)) : contribution);
+		}
+		for (int vertex = 0; vertex < ray.guidingVertexCount; ++vertex)
+		{
+			m_vertices[path.firstVertex + vertex].radiance += contribution;
+		}
+	}
+
+	for (size_t path = 0; path < m_paths.size(); ++path)
+	{
+		// everything gathered after the vertex arrived along its direction, divided by the throughput
+		// up to there it is the incident radiance
+		const size_t lastVertex = path + 1 < m_paths.size() ? m_paths[path + 1].firstVertex : m_vertices.size();
+		for (size_t i = m_paths[path].firstVertex; i < lastVertex; ++i)
+		{
+			const GuidingVertex &v = m_vertices[i];
+			float weight = average(v.throughput, m_paths[path].spectral);
+			if (weight > 0.0f)
+			{
+				m_guiding->Record(v.leaf, v.position, v.direction, average(v.radiance, m_paths[path].spectral) / weight, v.pdf);
+			}
+		}
+	}
+
+	m_paths.clear();
+	m_rays.clear();
+	m_vertices.clear();
+}
+
+Spectrum tracePath(const Scene *scene, Ray ray, vector3 cameraOrigin, int bounceCount, float lodSpread, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis,
+	const SampledWavelengths *wavelengths, GuidingField *guiding, bool learn, ShadowBatch *shadows, vector3 *albedo, vector3 *normal, float *depth)
+{
+	auto toSpectrum = [wavelengths](const vector3 &rgb)
+	{
+		return wavelengths ? wavelengths->FromRGB(rgb) : Spectrum(rgb);
+	};
+
+	Spectrum L;
+
+	bool hit = true;
+	int bounce = 0;
+	int crossings = 0;
+	Spectrum throughput(1.0f);
+	bool secondaryTerminated = false; // spectral paths only, see BSDF::IsDispersive
+	// media do not nest, leaving an interior always returns to the scene medium
+	const Medium *medium = scene->m_medium;
+	const EnvironmentMap *environment = scene->m_environment;
+	// solid angle pdf the current direction was sampled with, zero for the camera ray which is never MIS weighted
+	float scatterPdf = 0.0f;
+
+	// surface vertices whose incident radiance goes into the guiding field once the path is done
+	struct GuidingVertex
+	{
+		int leaf;
+		vector3 position;
+		vector3 direction;
+		float pdf;
+		Spectrum L; // radiance gathered up to and including the vertex
+		Spectrum throughput; // including the vertex
+	};
+	GuidingVertex guidingVertices[maxGuidingVertices];
+	int guidingVertexCount = 0;
+
+	while (bounce < bounceCount && hit)
+	{
+		Hit hitData;
+
+		hit = scene->Intersect(ray, &hitData);
+
+		// delta tracking up to the surface, tMax holds its distance after the intersection
+		float tCollision;
+		if (medium && medium->SampleCollision(ray, ray.tMax, gen, dis, &tCollision))
+		{
+			vector3 position = ray.origin + ray.direction * tCollision;
+			if (bounce == 0)
+			{
+				*albedo += medium->albedo;
+				*depth += (position - cameraOrigin).length();
+			}
+
+			// absorption is folded into the weight instead of terminating the path
+			throughput *= toSpectrum(medium->albedo);
+			for (size_t i = 0; i < scene->m_lights.size(); ++i)
+			{
+				const Light *light = scene->m_lights[i].get();
+				vector3 lightVec = light->pos - position;
+				float lightDistance = lightVec.length();
+				vector3 lightDir = lightVec / lightDistance;
+				float phase = henyeyGreenstein(ray.direction.dot(lightDir), medium->g);
+				shadows->Add(static_cast<int>(i), position, lightDir, lightDistance, medium,
+					toSpectrum(light->color) * throughput * (light->strength * phase / (lightDistance * lightDistance)), guidingVertexCount);
+			}
+
+			if (environment)
+			{
+				vector3 envDir;
+				float envPdf;
+				vector3 radiance = environment->Sample(dis(gen), dis(gen), &envDir, &envPdf);
+				if (envPdf > 0.0f)
+				{
+					float phase = henyeyGreenstein(ray.direction.dot(envDir), medium->g);
+					shadows->Add(ShadowBatch::environment, position, envDir, std::numeric_limits<float>::infinity(), medium,
+						toSpectrum(radiance) * throughput * (phase * powerHeuristic(envPdf, phase) / envPdf), guidingVertexCount);
+				}
+			}
+
+			float e0 = dis(gen);
+			float e1 = dis(gen);
+			vector3 scattered = sampleHenyeyGreenstein(ray.direction, medium->g, e0, e1);
+			scatterPdf = henyeyGreenstein(ray.direction.dot(scattered), medium->g);
+			Ray next(position, scattered);
+			continueCone(ray, tCollision, 1.0f - std::abs(medium->g), lodSpread, &next);
+			ray = next;
+			hit = true;
+			bounce++;
+			continue;
+		}
+
+		if (hit && !hitData.primitive->GetMaterial())
+		{
+			// invisible medium boundary, the path continues on the other side
+			medium = ray.direction.dot(hitData.normal) < 0.0f ? hitData.primitive->GetInterior() : scene->m_medium;
+			ray.coneWidth = ray.GetFootprint(ray.tMax);
+			ray.origin = hitData.position + ray.direction * boundaryOffset;
+			ray.tMax = std::numeric_limits<float>::infinity();
+			hit = ++crossings < maxBoundaryCrossings;
+			continue;
+		}
+
+		if (hit)
+		{
+			const float footprint = ray.GetFootprint(ray.tMax);
+			Material material = hitData.primitive->GetMaterial()->Evaluate(hitData, footprint * hitData.uvDensity);
+			Material *m = &material;
+			vector3 wo = -ray.direction;
+			BSDF bsdf(*m, toSpectrum(m->color), hitData.normal, wo, ray.coarse, wavelengths);
+
+			const int leaf = guiding && !bsdf.IsDelta() ? guiding->FindLeaf(hitData.position) : -1;
+			const float guidedFraction = leaf >= 0 && guiding->IsTrained(leaf) ? guidingFraction : 0.0f;
+			// density of the one sample strategy mixing the BSDF lobes and the guiding field
+			auto directionPdf = [&](const vector3 &wi)
+			{
+				float bsdfPdf = bsdf.Pdf(wi);
+				return guidedFraction > 0.0f ? lerp(bsdfPdf, guiding->Pdf(leaf, wi), guidedFraction) : bsdfPdf;
+			};
+
+			if (bounce == 0)
+			{
+				*albedo += m->color;
+				*normal += hitData.normal;
+				*depth += (hitData.position - cameraOrigin).length();
+			}
+
+			for (size_t i = 0; i < scene->m_lights.size(); ++i)
+			{
+				const Light *light = scene->m_lights[i].get();
+				vector3 lightVec = light->pos - hitData.position;
+				vector3 lightDir = lightVec.normalized();
+				float lightDistance = lightVec.length();
+				float attenuation = (lightDistance * lightDistance);
+				shadows->Add(static_cast<int>(i), hitData.position + (hitData.normal * 1e-6), lightDir, lightDistance, medium,
+					bsdf.Eval(lightDir) * toSpectrum(light->color) * throughput * (light->strength / attenuation), guidingVertexCount);
+			}
+
+			// one environment sample per hit, MIS weighted against the BSDF sampling below
+			if (environment)
+			{
+				vector3 envDir;
+				float envPdf;
+				vector3 radiance = environment->Sample(dis(gen), dis(gen), &envDir, &envPdf);
+				if (envPdf > 0.0f && envDir.dot(hitData.normal) > 0.0f)
+				{
+					shadows->Add(ShadowBatch::environment, hitData.position + (hitData.normal * 1e-6), envDir, std::numeric_limits<float>::infinity(), medium,
+						bsdf.Eval(envDir) * toSpectrum(radiance) * throughput * (powerHeuristic(envPdf, directionPdf(envDir)) / envPdf), guidingVertexCount);
+				}
+			}
+
+			vector3 reflected;
+			float lobeSpread = diffuseConeSpread;
+			float u = dis(gen);
+			float e0 = dis(gen);
+			float e1 = dis(gen);
+			if (guidedFraction > 0.0f && dis(gen) < guidedFraction)
+			{
+				guiding->Sample(leaf, e0, e1, &reflected);
+				// any strategy could have produced the direction, weighting by the mixture density keeps the
+				// estimate unbiased and lets MIS compare it with light sampling
+				scatterPdf = directionPdf(reflected);
+				if (!(scatterPdf > 0.0f) || reflected.dot(hitData.normal) <= 0.0f) break;
+				throughput *= bsdf.Eval(reflected) / scatterPdf;
+			}
+			else
+			{
+				BSDF::Lobe lobe;
+				float pdf;
+				Spectrum f = bsdf.Sample(u, e0, e1, &reflected, &pdf, &lobe);
+				if (!(pdf > 0.0f)) break;
+				if (lobe == BSDF::Lobe::Dielectric)
+				{
+					// no other strategy finds a delta direction, neither MIS nor guiding apply to it
+					scatterPdf = 0.0f;
+					lobeSpread = 0.0f;
+					throughput *= f / ((1.0f - guidedFraction) * pdf);
+					if (bsdf.IsDispersive() && !secondaryTerminated)
+					{
+						// the other wavelengths would have scattered elsewhere, the hero carries their share from here on
+						throughput *= Spectrum(vfloat4(4.0f, 0.0f, 0.0f, 0.0f));
+						secondaryTerminated = true;
+					}
+				}
+				else
+				{
+					scatterPdf = directionPdf(reflected);
+					if (lobe == BSDF::Lobe::Specular)
+					{
+						lobeSpread = 2.0f * m->roughness * m->roughness;
+					}
+					throughput *= f / scatterPdf;
+				}
+			}
+
+			// refraction crosses into or out of the shape's interior
+			const bool transmitted = reflected.dot(hitData.normal) * wo.dot(hitData.normal) < 0.0f;
+			if (transmitted)
+			{
+				medium = reflected.dot(hitData.normal) < 0.0f ? hitData.primitive->GetInterior() : scene->m_medium;
+			}
+
+			if (learn && leaf >= 0 && scatterPdf > 0.0f && guidingVertexCount < maxGuidingVertices)
+			{
+				guidingVertices[guidingVertexCount++] = { leaf, hitData.position, reflected, scatterPdf, L, throughput };
+			}
+
+			continueCone(ray, ray.tMax, lobeSpread, lodSpread, &ray);
+			ray.direction = reflected;
+			ray.tMax = std::numeric_limits<float>::infinity();
+			ray.origin = hitData.position;
+			ray.origin += ray.direction * (transmitted ? boundaryOffset : 1e-6f);
+
+			bounce++;
+		}
+		else
+		{
+			if (environment)
+			{
+				float weight = scatterPdf > 0.0f ? powerHeuristic(scatterPdf, environment->Pdf(ray.direction)) : 1.0f;
+				L += toSpectrum(environment->Evaluate(ray.direction)) * throughput * weight;
+			}
+			else if (scene->GetSkyMaterial())
+			{
+				L += toSpectrum(scene->GetSkyMaterial()->color) * throughput;
+			}
+			if (bounce == 0)
+			{
+				*albedo += vector3(1.0f, 1.0f, 1.0f);
+			}
+		}
+	}
+
+	// the batch records them once it knows what the shadow rays brought in
+	for (int i = 0; i < guidingVertexCount; ++i)
+	{
+		const GuidingVertex &v = guidingVertices[i];
+		shadows->AddGuidingVertex(v.leaf, v.position, v.direction, v.pdf, L - v.L, v.throughput);
+	}
+
+	return L;
+}
+
+bool RenderTile(const Scene *scene, const Camera &camera, const RenderSettings &settings, const tileData &data, int tileW,
+	GuidingField *guiding, bool learn, OcclusionCache *occlusion, std::minstd_rand &gen, const std::atomic<bool> *cancel)
+{
+	// the queued shadow rays are traced whenever there are this many, and at the end of the tile
+	static const size_t maxShadowBatch = 16384;
+
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	const int width = data.x2 - data.x1;
+	const int height = data.y2 - data.y1;
+	// compensated, so high sample counts do not lose the contribution of late samples
+	std::vector<SpectrumSum> pixels(width * height);
+	ShadowBatch shadows(scene, occlusion, guiding, pixels.data());
+
+	for (int y = 0; y < height; ++y)
+	{
+		if (cancel && *cancel)
+		{
+			return false;
+		}
+
+		for (int x = 0; x < width; ++x)
+		{
+			const int pixel = y * width + x;
+			const int sampleCount = settings.GetSampleCount(data.x1 + x, data.y1 + y);
+
+			vector3 albedo;
+			vector3 normal;
+			float depth = 0.0f;
+
+			for (int sample = 0; sample < sampleCount; ++sample)
+			{
+				float subSampleX;
+				float subSampleY;
+				hammersley(sample, sampleCount, 0, &subSampleX, &subSampleY);
+
+				Ray ray = camera.GenerateRay(static_cast<float>(data.x1 + x) + (subSampleX - 0.5f), static_cast<float>(data.y1 + y) + (subSampleY - 0.5f));
+
+				if (settings.spectral)
+				{
+					// stratified hero wavelength, consecutive samples cover the visible range evenly
+					SampledWavelengths wavelengths((sample + dis(gen)) / sampleCount);
+					shadows.BeginPath(pixel, &wavelengths);
+					Spectrum radiance = tracePath(scene, ray, camera.origin, settings.bounceCount, settings.shadingLodSpread, gen, dis, &wavelengths, guiding, learn, &shadows, &albedo, &normal, &depth);
+					pixels[pixel].Add(Spectrum(wavelengths.ToRGB(radiance)));
+				}
+				else
+				{
+					shadows.BeginPath(pixel, nullptr);
+					pixels[pixel].Add(tracePath(scene, ray, camera.origin, settings.bounceCount, settings.shadingLodSpread, gen, dis, nullptr, guiding, learn, &shadows, &albedo, &normal, &depth));
+				}
+
+				if (shadows.GetSize() >= maxShadowBatch)
+				{
+					shadows.Flush(gen, dis);
+				}
+			}
+
+			albedo /= static_cast<float>(sampleCount);
+			normal /= static_cast<float>(sampleCount);
+			depth /= static_cast<float>(sampleCount);
+
+			data.albedoOutput[(y * tileW + x) * 3 + 0] = albedo.x;
+			data.albedoOutput[(y * tileW + x) * 3 + 1] = albedo.y;
+			data.albedoOutput[(y * tileW + x) * 3 + 2] = albedo.z;
+			data.normalOutput[(y * tileW + x) * 3 + 0] = normal.x;
+			data.normalOutput[(y * tileW + x) * 3 + 1] = normal.y;
+			data.normalOutput[(y * tileW + x) * 3 + 2] = normal.z;
+			data.depthOutput[y * tileW + x] = depth;
+		}
+	}
+
+	// direct light only arrives with the shadow rays, the colors have to wait for them
+	shadows.Flush(gen, dis);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			const int sampleCount = settings.GetSampleCount(data.x1 + x, data.y1 + y);
+			vector3 color = (pixels[y * width + x].Get() / static_cast<float>(sampleCount)).ToVector3();
+			data.tileOutput[(y * tileW + x) * 3 + 0] = color.x;
+			data.tileOutput[(y * tileW + x) * 3 + 1] = color.y;
+			data.tileOutput[(y * tileW + x) * 3 + 2] = color.z;
+		}
+	}
+	return true;
+}
+
+float EstimateTileCost(const Scene *scene, const Camera &camera, const RenderSettings &settings, const tileData &tile, OcclusionCache *occlusion,
+	std::minstd_rand &gen)
+{
+	static const int costGridStep = 4;
+
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	ShadowBatch shadows(scene, occlusion, nullptr, nullptr);
+	int samples = 0;
+	int paths = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int y = tile.y1; y < tile.y2; y += costGridStep)
+	{
+		for (int x = tile.x1; x < tile.x2; x += costGridStep)
+		{
+			samples += settings.GetSampleCount(x, y);
+			paths++;
+			vector3 albedo;
+			vector3 normal;
+			float depth = 0.0f;
+			Ray ray = camera.GenerateRay(x + 0.5f, y + 0.5f);
+			shadows.BeginPath(0, nullptr);
+			tracePath(scene, ray, camera.origin, settings.bounceCount, settings.shadingLodSpread, gen, dis, nullptr, nullptr, false, &shadows, &albedo, &normal, &depth);
+		}
+	}
+	shadows.Flush(gen, dis);
+	// sample regions make some tiles more expensive than their paths alone suggest
+	float elapsed = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+	return paths > 0 ? elapsed * samples / paths : elapsed;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "math.h"
+#include "ray.h"
+#include "spectrum.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+class Scene;
+class Camera;
+class RenderSettings;
+class GuidingField;
+class OcclusionCache;
+class Medium;
+
+// Shadow rays whose contribution is only known once they are traced. Paths queue them instead of
+// tracing them on the spot; Flush traces them light by light, so consecutive rays share their light
+// and mostly their occluder, and adds what gets through to the pixel and the guiding records of the
+// path that cast them.
+class ShadowBatch
+{
+public:
+	static const int environment = -1;
+
+	// pixels and guiding may be null when nobody needs the result.
+	ShadowBatch(const Scene *scene, OcclusionCache *occlusion, GuidingField *guiding, SpectrumSum *pixels);
+
+	// Starts a camera path of the pixel, wavelengths is null for RGB paths.
+	void BeginPath(int pixel, const SampledWavelengths *wavelengths);
+	// Queues a ray towards a light, or the environment, that adds contribution times its
+	// transmittance. Only the first guidingVertexCount guiding vertices of the path see it.
+	void Add(int light, vector3 origin, vector3 direction, float distance, const Medium *medium, const Spectrum &contribution, int guidingVertexCount);
+	// The current path's guiding vertices in path order. radiance arrived along direction without
+	// the queued shadow rays, throughput is the path's up to and including the vertex.
+	void AddGuidingVertex(int leaf, vector3 position, vector3 direction, float pdf, const Spectrum &radiance, const Spectrum &throughput);
+
+	size_t GetSize() const { return m_rays.size(); }
+	void Flush(std::minstd_rand &gen, std::uniform_real_distribution<float> &dis);
+
+private:
+	struct Path
+	{
+		int pixel;
+		bool spectral;
+		SampledWavelengths wavelengths{ 0.0f };
+		size_t firstVertex;
+	};
+
+	struct ShadowRay
+	{
+		vector3 origin;
+		vector3 direction;
+		float distance;
+		const Medium *medium;
+		Spectrum contribution;
+		int path;
+		int slot; // into the OcclusionCache, the environment comes after the lights
+		int guidingVertexCount;
+	};
+
+	struct GuidingVertex
+	{
+		int leaf;
+		vector3 position;
+		vector3 direction;
+		float pdf;
+		Spectrum radiance;
+		Spectrum throughput;
+	};
+
+	const Scene *m_scene;
+	OcclusionCache *m_occlusion;
+	GuidingField *m_guiding;
+	SpectrumSum *m_pixels;
+	std::vector<Path> m_paths;
+	std::vector<ShadowRay> m_rays;
+	std::vector<GuidingVertex> m_vertices;
+	std::vector<uint32_t> m_order;
+	std::vector<uint32_t> m_slotStarts;
+};
+
+// Traces one camera path and returns its radiance, apart from the shadow rays it queues in shadows
+// under the path started last. First-hit features for the denoiser are accumulated into albedo,
+// normal and depth. With wavelengths the path is spectral and the result holds the radiance at those
+// wavelengths, otherwise it is RGB. Bounces past a ray cone spread of lodSpread are shaded with
+// cheaper approximations, see RenderSettings::shadingLodSpread. Where guiding has learned something
+// it samples part of the bounces, with learn the path also records its incident radiance into it
+// through shadows.
+Spectrum tracePath(const Scene *scene, Ray ray, vector3 cameraOrigin, int bounceCount, float lodSpread, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis,
+	const SampledWavelengths *wavelengths, GuidingField *guiding, bool learn, ShadowBatch *shadows, vector3 *albedo, vector3 *normal, float *depth);
+
+// Renders every pixel of the tile, outputs are written with a row stride of tileW pixels. occlusion
+// belongs to the calling worker and is bound to the scene. Returns false if cancel was raised before
+// the tile was done.
+bool RenderTile(const Scene *scene, const Camera &camera, const RenderSettings &settings, const tileData &data, int tileW,
+	GuidingField *guiding, bool learn, OcclusionCache *occlusion, std::minstd_rand &gen, const std::atomic<bool> *cancel);
+
+// Low sample pre-pass: times one path for every few pixels of the tile, scaled by their sample
+// budgets. The scheduler uses the result to split expensive tiles at the end of the frame.
+float EstimateTileCost(const Scene *scene, const Camera &camera, const RenderSettings &settings, const tileData &tile, OcclusionCache *occlusion,
+	std::minstd_rand &gen);
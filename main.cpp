@@ -1,26 +1,15 @@
 #include "math.h"
-#include "sphere.h"
-#include "plane.h"
-#include "ray.h"
 #include "scene.h"
-#include "primitive.h"
-#include "light.h"
-#include "material.h"
+#include "renderer.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <cstdint>
-#include <limits>
 #include <algorithm>
-#include <random>
-#include <functional>
-#include <thread>
-#include <cstdint>
-#include <mutex>
-#include <optional>
 #include <atomic>
-#include <chrono>
+#include <mutex>
+#include <string>
 
 float toSRGB(float in)
 {
@@ -34,53 +23,6 @@ float toSRGB(float in)
 	}
 }
 
-float disneySchlick(float u)
-{
-	return std::pow(1.0f - u, 5.0f);
-}
-
-float disneyGTR2(float NdotH, float alpha) {
-	float alpha2 = alpha * alpha;
-	float t = 1.0f + (alpha2 - 1.0f) * NdotH * NdotH;
-	return alpha2 / (pi * t * t);
-}
-
-float disneySmithG_GGX(float NdotV, float alphaG) {
-	float a = alphaG * alphaG;
-	float b = NdotV * NdotV;
-	return 1.0 / (NdotV + sqrt(a + b - a * b));
-}
-
-vector3 DisneyBRDF(vector3 N, vector3 L, vector3 V, vector3 baseColor, float roughness, float metalness)
-{
-	float NdotV = N.dot(V);
-	float NdotL = N.dot(L);
-
-	roughness = std::max(0.001f, roughness); // just in case
-
-	vector3 H = (L + V).normalized();
-	float LdotH = L.dot(H);
-	float NdotH = N.dot(H);
-
-	vector3 f0 = lerp(vector3(0.04f, 0.04f, 0.04f), baseColor, metalness); // 4% reflectivity for dielectrics
-
-	//diffuse
-	float FL = disneySchlick(NdotL);
-	float FV = disneySchlick(NdotV);
-	float Fd90 = 0.5f + 2.0f * NdotH * LdotH * roughness;
-	float Fd = lerp(1.0f, Fd90, FL) * lerp(1.0f, Fd90, FV);
-
-	//specular
-	float alpha = roughness * roughness;
-	float Ds = disneyGTR2(NdotH, alpha);
-	float FH = disneySchlick(LdotH);
-	vector3 Fs = lerp(f0, vector3(1.0f, 1.0f, 1.0f), FH);
-	float roughg = (roughness * 0.5f + 0.5f) * (roughness * 0.5f + 0.5f);
-	float Gs = disneySmithG_GGX(NdotL, roughg) * disneySmithG_GGX(NdotV, roughg);
-
-	return (rcpPi * Fd * (1.0f - metalness) * baseColor + Gs * Fs * Ds) * clamp(NdotL, 0.0f, 1.0f);
-}
-
 vector3 Reinhard(vector3 color)
 {
 	vector3 mapped = color / (color + vector3(1.0f, 1.0f, 1.0f));
@@ -98,410 +40,137 @@ vector3 ACES(vector3 x)
 	return clamp((x*(a*x + b)) / (x*(c*x + d) + e), 0.0f, 1.0f);
 }
 
-void coordinateSystem(const vector3 &v1, vector3 *v2, vector3 *v3)
-{
-	if (std::abs(v1.x) > std::abs(v1.y))
-	{
-		*v2 = vector3(-v1.z, 0.0f, v1.x) / std::sqrt(v1.x * v1.x + v1.z * v1.z);
-	}
-	else
-	{
-		*v2 = vector3(0.0f, v1.z, -v1.y) / std::sqrt(v1.y * v1.y + v1.z * v1.z);
-	}
-	*v3 = v1.cross(*v2);
-}
-
-#if 1
-vector3 TransformToWorld(float x, float y, float z, vector3 &normal) {
-	// Find an axis that is not parallel to normal
-	vector3 majorAxis;
-	if (std::abs(normal.x) < 0.57735026919f /* 1 / sqrt(3) */) {
-		majorAxis = vector3(1, 0, 0);
-	}
-	else if (std::abs(normal.y) < 0.57735026919f /* 1 / sqrt(3) */) {
-		majorAxis = vector3(0, 1, 0);
-	}
-	else {
-		majorAxis = vector3(0, 0, 1);
-	}
-
-	// Use majorAxis to create a coordinate system relative to world space
-	vector3 u = normal.cross(majorAxis);
-	vector3 v = normal.cross(u);
-	vector3 w = normal;
-
-
-	// Transform from local coordinates to world coordinates
-	return u * x +
-		v * y +
-		w * z;
-}
-#endif
-
-static float SmithGGXMaskingShadowing(vector3 wi, vector3 wo, vector3 normal, float a2)
+static void printUsage()
 {
-	float dotNL = normal.dot(wi);
-	float dotNV = normal.dot(wo);
-
-	float denomA = dotNV * std::sqrt(a2 + (1.0f - a2) * dotNL * dotNL);
-	float denomB = dotNL * std::sqrt(a2 + (1.0f - a2) * dotNV * dotNV);
-
-	return 2.0f * dotNL * dotNV / (denomA + denomB);
+	std::cerr << "usage: rt [--spp n] [--preview scale] [--crop x1 y1 x2 y2] [--region x1 y1 x2 y2 spp]... [--merge frame.pfm]" << std::endl;
+	std::cerr << "  windows are in full resolution pixels, x2 and y2 exclusive" << std::endl;
+	std::cerr << "  --merge copies the crop into an existing frame of the output or full resolution, or creates it" << std::endl;
 }
 
-vector3 ImportanceSampleGGX(float e0, float e1, vector3 normal, vector3 wo, Material *m, vector3 &wi)
+// Reads count integers following argument i, advancing i past them.
+static bool readInts(int argc, char **argv, int *i, int count, int *values)
 {
-	float a = m->roughness * m->roughness;
-	float a2 = a * a;
-
-	float theta = std::acos(std::sqrt((1.0f - e0) / ((a2 - 1.0f) * e0 + 1.0f)));
-	float phi = 2.0f * pi * e1;
-
-	vector3 wm = vector3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)).normalized();
-
-	vector3 tangent;
-	vector3 binormal;
-	coordinateSystem(normal, &tangent, &binormal);
-	wm = tangent * wm.x + normal * wm.y + binormal * wm.z;
-	//wm = TransformToWorld(wm.x, wm.y, wm.z, normal);
-
-	wi = 2.0f * wo.dot(wm) * wm - wo;
-
-	float dotWiWm = wi.dot(wm);
-	if (normal.dot(wi) > 0.0f && dotWiWm > 0.0f)
-	{
-		float dotWoWm = wo.dot(wm);
-		float dotNWo = normal.dot(wo);
-		float dotNWi = normal.dot(wi);
-		vector3 f0 = lerp(0.04f, m->color, m->metalness); // 4% reflectivity for dielectrics
-		vector3 F = lerp(f0, 1.0f, disneySchlick(dotWiWm));
-		//float G = disneySmithG_GGX(dotNWo, a2) * disneySmithG_GGX(dotNWi, a2);
-		float G = SmithGGXMaskingShadowing(wi, wo, normal, a2);
-		float weight = std::abs(dotWoWm) / (dotNWo * normal.dot(wm));
-
-		return F * G * weight;
-	}
-	else
+	if (*i + count >= argc) return false;
+	for (int k = 0; k < count; ++k)
 	{
-		return vector3(0.0f, 0.0f, 0.0f);
+		try
+		{
+			values[k] = std::stoi(argv[++*i]);
+		}
+		catch (const std::exception &)
+		{
+			return false;
+		}
 	}
+	return true;
 }
 
-vector3 ImportanceSample(vector3 normal, std::function<float(void)> randomGen)
+static bool parseArguments(int argc, char **argv, RenderSettings *settings, std::string *mergePath)
 {
-	float rand = randomGen();
-	float r = std::sqrt(rand);
-	float theta = randomGen() * 2.0f * pi;
-
-	float x = r * std::cos(theta);
-	float y = r * std::sin(theta);
-
-	float z = std::sqrt(1.0f - x * x - y * y);
-
-	return TransformToWorld(x, y, z, normal).normalized();
-}
-
-float pdf(vector3 inputDirection, vector3 normal)
-{
-	return inputDirection.dot(normal) * rcpPi;
-}
-
-float radicalInverse_VdC(uint32_t bits) {
-	bits = (bits << 16u) | (bits >> 16u);
-	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-	return float(bits) * 2.3283064365386963e-10; // / 0x100000000
-}
-
-void hammersley(uint32_t i, uint32_t N, uint32_t offset, float *a, float *b)
-{
-	*a = static_cast<float>(i) / static_cast<float>(N);
-	*b = radicalInverse_VdC(i + offset);
-}
-
-struct tileData
-{
-	int x1;
-	int y1;
-	int x2;
-	int y2;
-	float *tileOutput;
-};
-
-vector3 diffuseSample(float e0, float e1, vector3 normal, vector3 wo, Material *m, vector3 &wi)
-{
-	float theta = 0.5f * pi * e0;
-	float phi = 2.0f * pi * e1;
-
-	wi = vector3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)).normalized();
-
-	vector3 tangent;
-	vector3 binormal;
-	coordinateSystem(normal, &tangent, &binormal);
-	wi = tangent * wi.x + normal * wi.y + binormal * wi.z;
-
-	vector3 H = (wi + wo).normalized();
-	float LdotH = wi.dot(H);
-	float NdotH = normal.dot(H);
-
-	float NdotV = normal.dot(wo);
-	float NdotL = normal.dot(wi);
-
-	//diffuse
-	float FL = disneySchlick(NdotL);
-	float FV = disneySchlick(NdotV);
-	float Fd90 = 0.5f + 2.0f * NdotH * LdotH * m->roughness;
-	float Fd = lerp(1.0f, Fd90, FL) * lerp(1.0f, Fd90, FV);
-
-	return (rcpPi * Fd * (1.0f - m->metalness) * m->color) * clamp(NdotL, 0.0f, 1.0f);
-}
-
-void renderWorker(std::vector<tileData> *tileInfos, std::mutex *tileLock, std::atomic<int> *completedTiles, int tileW, int tileH, int imageW, int imageH, float filmW, float filmH, vector3 cameraOrigin, const Scene *scene)
-{
-	auto getTile = [tileInfos, tileLock]()->std::optional<tileData>
+	for (int i = 1; i < argc; ++i)
 	{
-		std::scoped_lock lock(*tileLock);
-		if (tileInfos->size() > 0)
+		const std::string arg = argv[i];
+		int values[5];
+		if (arg == "--spp" && readInts(argc, argv, &i, 1, values) && values[0] > 0)
 		{
-			tileData data = tileInfos->back();
-			tileInfos->pop_back();
-			return data;
+			settings->sampleCount = values[0];
 		}
-		return std::nullopt;
-	};
-
-	std::random_device rd;
-	std::minstd_rand gen(rd());
-	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-
-	static const int sampleCount = 64; // TODO: move this someplace better
-	static const int bounceCount = 10; // TODO: move this someplace better
-	auto tile = getTile();
-	while (tile.has_value())
-	{
-		tileData data = tile.value();
-//		std::cout << "Rendering tile x: " << data.x1 << " y: " << data.y1 << std::endl;
-
-		for (int y = 0; y < data.y2 - data.y1; ++y)
+		else if (arg == "--preview" && readInts(argc, argv, &i, 1, values) && values[0] > 0)
 		{
-			for (int x = 0; x < data.x2 - data.x1; ++x)
-			{
-				vector3 L;
-
-				for (int sample = 0; sample < sampleCount; ++sample)
-				{
-	/*				if (x == 57 && y == 162)
-					{
-						std::cout << x << std::endl;
-					}*/
-					float subSampleX;
-					float subSampleY;
-					hammersley(sample, sampleCount, 0, &subSampleX, &subSampleY);
-
-					float filmX = (2.0f * (static_cast<float>(data.x1 + x) + (subSampleX - 0.5f)) / imageW - 1.0f) * filmW;
-					float filmY = (1.0f - 2.0f * (static_cast<float>(data.y1 + y) + (subSampleY - 0.5f)) / imageH) * filmH;
-					float filmZ = -1.0f;
-					vector3 filmDir(filmX, filmY, filmZ);
-					Ray ray(cameraOrigin, filmDir.normalized());
-
-					bool hit = true;
-					int bounce = 0;
-					vector3 throughput(1.0f, 1.0f, 1.0f);
-
-					while (bounce < bounceCount && hit)
-					{
-						Hit hitData;
-
-						hit = scene->Intersect(ray, &hitData);
-						if (hit)
-						{
-							Material *m = hitData.primitive->GetMaterial();
-
-							for (auto &light : scene->m_lights)
-							{
-								vector3 lightVec = light->pos - hitData.position;
-								vector3 lightDir = lightVec.normalized();
-								Ray lightRay(hitData.position + (hitData.normal * 1e-6), lightDir);
-								if (!scene->Intersect(lightRay, nullptr))
-								{
-									float lightDistance = lightVec.length();
-									float lightContrib = lightDir.dot(hitData.normal);
-									float attenuation = (lightDistance * lightDistance);
-									L += DisneyBRDF(hitData.normal, lightDir, -ray.direction, m->color, m->roughness, m->metalness) * light->color * light->strength * throughput / attenuation;
-								}
-							}
-
-							//vector3 reflected = ray.direction - (2.0f * (hitData.normal.dot(ray.direction)) * hitData.normal);
-							//auto rnd = [&gen, &dis]() {
-							//	return dis(gen());
-							//}
-
-	/*						vector3 tangent;
-							vector3 binormal;
-							coordinateSystem(hitData.normal, &tangent, &binormal);*/
-
-							vector3 wo = -ray.direction;
-	//						wo = vector3(hitData.normal.dot(wo), tangent.dot(wo), binormal.dot(wo));
-
-							vector3 reflected;
-
-							float r = dis(gen);
-							if (r < 0.5f) { // specular bounce
-								float e0 = dis(gen);
-								float e1 = dis(gen);
-								//hammersley(sample, sampleCount, 0, &e0, &e1);
-								throughput *= ImportanceSampleGGX(e0, e1, hitData.normal, wo, m, reflected);
-	//							throughput *= ImportanceSampleGGX([&gen, &dis]()->float { return dis(gen); }, hitData.normal, wo, m, reflected);
-		//						reflected = ImportanceSample(hitData.normal, [&gen, &dis]()->float { return dis(gen); });
-		//						throughput *= DisneyBRDF(hitData.normal, reflected, -ray.direction, m->color, m->roughness, m->metalness) / pdf(reflected, hitData.normal);
-
-		//						reflected = hitData.normal * reflected.x + tangent * reflected.y + binormal * reflected.z;
-							}
-							else
-							{ // diffuse bounce
-								float e0 = dis(gen);
-								float e1 = dis(gen);
-
-								throughput *= diffuseSample(e0, e1, hitData.normal, wo, m, reflected);
-							}
-
-							ray.direction = reflected;
-							ray.tMax = std::numeric_limits<float>::infinity();
-							ray.origin = hitData.position;
-							ray.origin += ray.direction * 1e-6;
-
-							bounce++;
-						}
-						else
-						{
-							if (scene->GetSkyMaterial())
-							{
-								L += scene->GetSkyMaterial()->color * throughput;
-							}
-						}
-					}
-				}
-
-//				L = Reinhard(L / static_cast<float>(sampleCount));
-				L = ACES(L / static_cast<float>(sampleCount));
-
-				data.tileOutput[(y * tileW + x) * 3 + 0] = toSRGB(L.x);
-				data.tileOutput[(y * tileW + x) * 3 + 1] = toSRGB(L.y);
-				data.tileOutput[(y * tileW + x) * 3 + 2] = toSRGB(L.z);
-			}
+			settings->previewScale = values[0];
+		}
+		else if (arg == "--crop" && readInts(argc, argv, &i, 4, values))
+		{
+			settings->crop = { values[0], values[1], values[2], values[3] };
+		}
+		else if (arg == "--region" && readInts(argc, argv, &i, 5, values) && values[4] > 0)
+		{
+			settings->sampleRegions.push_back({ { values[0], values[1], values[2], values[3] }, values[4] });
+		}
+		else if (arg == "--merge" && i + 1 < argc)
+		{
+			*mergePath = argv[++i];
+		}
+		else
+		{
+			return false;
 		}
-		(*completedTiles)++;
-		tile = getTile();
 	}
+	return true;
 }
 
-int main() {
+int main(int argc, char **argv) {
 	const int IMAGE_W = 1920;
 	const int IMAGE_H = 1080;
-	const float imageW = static_cast<float>(IMAGE_W);
-	const float imageH = static_cast<float>(IMAGE_H);
-
-	//Material red(vector3(1.0f, 1.0f, 1.0f), 0.1f, 1.0f);
-	Material red(vector3(1.0f, 0.0f, 0.0f), 0.1f, 0.0f);
-	Material brown(vector3(0.0f, 0.43f, 0.0f), 1.0f, 0.0f);
-	//Material brown(vector3(1.0f, 1.0f, 1.0f), 0.01f, 1.0f);
-	Material sky(vector3(0.0f, 0.2f, 0.5f), 1.0f, 0.0f);
 
-	std::unique_ptr<GeometricPrimitive> sphere1 = std::make_unique<GeometricPrimitive>(std::make_unique<Sphere>(vector3(0.0f, 0.0f, -3.0f), 0.5f), &red);
-	std::unique_ptr<GeometricPrimitive> plane1 = std::make_unique<GeometricPrimitive>(std::make_unique<Plane>(vector3(0.0f, 1.0f, 0.0f), -0.5f), &brown);
-	std::vector<std::unique_ptr<Primitive>> primitives;
-	primitives.push_back(std::move(sphere1));
-	primitives.push_back(std::move(plane1));
-	LoosePrimitives prims(std::move(primitives));
-
-	std::vector<std::unique_ptr<Light>> lights;
-	lights.push_back(std::make_unique<Light>(vector3(-1.5f, 1.0f, 3.0f), vector3(1.0f, 1.0f, 1.0f), 100.0f));
-
-	Scene scene(prims, lights);
-	scene.m_skyMaterial = &sky;
-
-	vector3 cameraOrigin(0.0f, 0.0f, 0.0f);
-	float fov = 37.8f;
-	float aspect = imageW / imageH;
-	float filmW = tan(fov / 2.0f * pi / 180.0f) * aspect;
-	float filmH = tan(fov / 2.0f * pi / 180.0f);
-
-	static const int tileWidth = 32;
-	static const int tileHeight = 32;
-	static const int tileStride = tileWidth * tileHeight * 3;
-	static const int tileCountX = divideRoundingUp(IMAGE_W, tileWidth);
-	static const int tileCountY = divideRoundingUp(IMAGE_H, tileHeight);
-	static const int tileCount = tileCountX * tileCountY;
-	std::atomic<int> completedTiles = 0;
-
-	std::vector<float> image(tileCountX * tileCountY * tileStride);
-
-	std::vector<tileData> tiles;
+	RenderSettings settings;
+	settings.width = IMAGE_W;
+	settings.height = IMAGE_H;
+	settings.cameraOrigin = vector3(0.0f, 0.0f, 0.0f);
+	settings.fov = 37.8f;
+	std::string mergePath;
+	if (!parseArguments(argc, argv, &settings, &mergePath))
+	{
+		printUsage();
+		return 1;
+	}
 
-	for (int y = 0; y < tileCountY; ++y)
+	SceneBuilder builder;
+	builder.SetAggregate(AggregateType::BVH);
+	//Material *red = builder.AddMaterial(vector3(1.0f, 1.0f, 1.0f), 0.1f, 1.0f);
+	Material *red = builder.AddMaterial(vector3(1.0f, 0.0f, 0.0f), 0.1f, 0.0f);
+	Material *brown = builder.AddMaterial(vector3(0.0f, 0.43f, 0.0f), 1.0f, 0.0f);
+	//Material *brown = builder.AddMaterial(vector3(1.0f, 1.0f, 1.0f), 0.01f, 1.0f);
+	builder.SetSky(vector3(0.0f, 0.2f, 0.5f));
+
+	builder.AddSphere(vector3(0.0f, 0.0f, -3.0f), 0.5f, red);
+	builder.AddPlane(vector3(0.0f, 1.0f, 0.0f), -0.5f, brown);
+	builder.AddLight(vector3(-1.5f, 1.0f, 3.0f), vector3(1.0f, 1.0f, 1.0f), 100.0f);
+	std::unique_ptr<Scene> scene = builder.Build();
+	std::cout << scene->GetPrimitiveCount() << " primitives, " << scene->GetBytesPerPrimitive() << " bytes per primitive" << std::endl;
+
+	std::mutex printLock;
+	int printedPercent = -1;
+	Renderer renderer;
+	std::shared_ptr<RenderJob> job = renderer.Submit(*scene, settings, [&](const RenderJob &job, const tileData &)
 	{
-		for (int x = 0; x < tileCountX; ++x)
+		int percent = static_cast<int>(job.GetProgress() * 100.0f);
+		std::scoped_lock lock(printLock);
+		if (percent != printedPercent)
 		{
-			tileData tile;
-			tile.x1 = x * tileWidth;
-			tile.y1 = y * tileHeight;
-			tile.x2 = std::min((x + 1) * tileWidth, IMAGE_W);
-			tile.y2 = std::min((y + 1) * tileHeight, IMAGE_H);
-			tile.tileOutput = &image[(y * tileCountX + x) * tileStride];
-			tiles.push_back(tile);
+			std::cout << percent << "%" << std::endl;
+			printedPercent = percent;
 		}
-	}
-
-	std::vector<std::thread> workers;
-	std::mutex tileLock;
-	int maxThreads = 1;// std::thread::hardware_concurrency();
-	for (int i = 0; i < maxThreads; ++i) {
-		std::thread t(renderWorker, &tiles, &tileLock, &completedTiles, tileWidth, tileHeight, IMAGE_W, IMAGE_H, filmW, filmH, cameraOrigin, &scene);
-		workers.push_back(std::move(t));
-	}
+	});
 
-	while (completedTiles < tileCount)
+	if (!job->Wait())
 	{
-		std::cout << completedTiles << "/" << tileCount << std::endl;
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		return 1;
 	}
-
-	for (int i = 0; i < maxThreads; ++i)
+	if (!mergePath.empty() && !job->MergeInto(mergePath))
 	{
-		workers[i].join();
+		std::cerr << "cannot merge into " << mergePath << std::endl;
+		return 1;
 	}
+	const std::vector<float> &image = job->GetFramebuffer();
+	// previews come out smaller than the frame
+	const int outputW = job->GetSettings().width;
+	const int outputH = job->GetSettings().height;
 
-	std::vector<uint8_t> data(IMAGE_W * IMAGE_H * 3);
-	for (int y = 0; y < tileCountY; ++y)
+	std::vector<uint8_t> data(outputW * outputH * 3);
+	for (int i = 0; i < outputW * outputH; ++i)
 	{
-		for (int x = 0; x < tileCountX; ++x)
-		{
-			for (int tileY = 0; tileY < tileHeight; ++tileY)
-			{
-				for (int tileX = 0; tileX < tileWidth; ++tileX)
-				{
-					int targetX = x * tileWidth + tileX;
-					int targetY = y * tileHeight + tileY;
-					if (targetX < IMAGE_W && targetY < IMAGE_H)
-					{
-						data[(targetY * IMAGE_W + targetX) * 3 + 0] =
-							static_cast<uint8_t>(image[(y * tileCountX + x) * tileStride + (tileY * tileWidth + tileX) * 3 + 0] * 255.0f + 0.5f);
-						data[(targetY * IMAGE_W + targetX) * 3 + 1] =
-							static_cast<uint8_t>(image[(y * tileCountX + x) * tileStride + (tileY * tileWidth + tileX) * 3 + 1] * 255.0f + 0.5f);
-						data[(targetY * IMAGE_W + targetX) * 3 + 2] =
-							static_cast<uint8_t>(image[(y * tileCountX + x) * tileStride + (tileY * tileWidth + tileX) * 3 + 2] * 255.0f + 0.5f);
-					}
-				}
-			}
-		}
+//		vector3 L = Reinhard(vector3(image[i * 3 + 0], image[i * 3 + 1], image[i * 3 + 2]));
+		vector3 L = ACES(vector3(image[i * 3 + 0], image[i * 3 + 1], image[i * 3 + 2]));
+		data[i * 3 + 0] = static_cast<uint8_t>(toSRGB(L.x) * 255.0f + 0.5f);
+		data[i * 3 + 1] = static_cast<uint8_t>(toSRGB(L.y) * 255.0f + 0.5f);
+		data[i * 3 + 2] = static_cast<uint8_t>(toSRGB(L.z) * 255.0f + 0.5f);
 	}
 
 	std::fstream f("out.ppm", std::fstream::binary | std::fstream::out);
 
 	f << "P6\n";
-	f << IMAGE_W << " " << IMAGE_H << "\n";
+	f << outputW << " " << outputH << "\n";
 	f << "255\n";
 	f.write(reinterpret_cast<char*>(data.data()), data.size());
 
@@ -0,0 +1,24 @@
+#include "material.h"
+#include "texture.h"
+#include "hit.h"
+
+Material Material::Evaluate(const Hit &hit, float footprint) const
+{
+	Material result(color, roughness, metalness);
+	result.transmission = transmission;
+	result.ior = ior;
+	result.dispersion = dispersion;
+	if (colorMap)
+	{
+		result.color = colorMap->Sample(hit.u, hit.v, colorMap->GetLod(footprint));
+	}
+	if (roughnessMap)
+	{
+		result.roughness = roughnessMap->Sample(hit.u, hit.v, roughnessMap->GetLod(footprint)).x;
+	}
+	if (metalnessMap)
+	{
+		result.metalness = metalnessMap->Sample(hit.u, hit.v, metalnessMap->GetLod(footprint)).x;
+	}
+	return result;
+}
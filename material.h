@@ -1,12 +1,30 @@
+#pragma once
+
 #include "math.h"
 
+class Hit;
+class Texture;
+
 class Material
 {
 public:
 	Material(vector3 color_, float roughness_, float metalness_): color(color_), roughness(roughness_), metalness(metalness_) {}
 
+	// Resolves the texture maps at the hit into a constant material. footprint is the width the hit
+	// stands for in uv units, every map picks its mip level from it.
+	Material Evaluate(const Hit &hit, float footprint) const;
+
 	vector3 color;
 	float roughness;
 	float metalness;
+	// share of the non-metallic part that is a smooth dielectric, refracting with index of refraction ior
+	float transmission = 0.0f;
+	float ior = 1.5f; // at 589.3 nm when dispersive
+	// Cauchy B coefficient in um^2, n(lambda) = ior + dispersion * (1 / lambda^2 - 1 / 0.5893^2).
+	// Only spectral paths see it, e.g. 0.0042 for BK7 and 0.0136 for dense flint glass
+	float dispersion = 0.0f;
+	// optional maps, these replace the constant values above; roughness and metalness read the red channel
+	const Texture *colorMap = nullptr;
+	const Texture *roughnessMap = nullptr;
+	const Texture *metalnessMap = nullptr;
 };
-
@@ -0,0 +1,280 @@
+#include "medium.h"
+#include "brdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// below this a tracked transmittance is continued or terminated by russian roulette
+static const float rouletteTransmittance = 0.1f;
+
+static float sampleExponential(float u, float sigma)
+{
+	return -std::log(1.0f - u) / sigma;
+}
+
+bool HomogeneousMedium::SampleCollision(const Ray &, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis, float *t) const
+{
+	if (m_sigmaT <= 0.0f) return false;
+	float tCollision = sampleExponential(dis(gen), m_sigmaT);
+	if (tCollision >= tMax) return false;
+	*t = tCollision;
+	return true;
+}
+
+float HomogeneousMedium::Transmittance(const Ray &, float tMax, std::minstd_rand &, std::uniform_real_distribution<float> &) const
+{
+	return m_sigmaT > 0.0f ? std::exp(-m_sigmaT * tMax) : 1.0f;
+}
+
+GridMedium::GridMedium(const AABB &bounds, int resX, int resY, int resZ, const std::vector<float> &density, float sigmaScale, vector3 albedo, float g)
+	: Medium(albedo, g)
+	, m_bounds(bounds)
+{
+	m_res[0] = resX;
+	m_res[1] = resY;
+	m_res[2] = resZ;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		m_blockCount[axis] = divideRoundingUp(m_res[axis], blockSize);
+	}
+	m_voxelSize = bounds.Extent() / vector3(static_cast<float>(resX), static_cast<float>(resY), static_cast<float>(resZ));
+
+	auto source = [&](int x, int y, int z)
+	{
+		x = std::min(std::max(x, 0), resX - 1);
+		y = std::min(std::max(y, 0), resY - 1);
+		z = std::min(std::max(z, 0), resZ - 1);
+		return std::max(0.0f, density[(static_cast<size_t>(z) * resY + y) * resX + x] * sigmaScale);
+	};
+
+	const int totalBlocks = m_blockCount[0] * m_blockCount[1] * m_blockCount[2];
+	m_blockIndex.assign(totalBlocks, -1);
+	m_majorant.assign(totalBlocks, 0.0f);
+	int allocated = 0;
+	for (int bz = 0; bz < m_blockCount[2]; ++bz)
+	{
+		for (int by = 0; by < m_blockCount[1]; ++by)
+		{
+			for (int bx = 0; bx < m_blockCount[0]; ++bx)
+			{
+				const int block = (bz * m_blockCount[1] + by) * m_blockCount[0] + bx;
+
+				// trilinear lookups inside the block reach one voxel into the neighbouring blocks
+				float majorant = 0.0f;
+				for (int z = bz * blockSize - 1; z <= (bz + 1) * blockSize; ++z)
+				{
+					for (int y = by * blockSize - 1; y <= (by + 1) * blockSize; ++y)
+					{
+						for (int x = bx * blockSize - 1; x <= (bx + 1) * blockSize; ++x)
+						{
+							majorant = std::max(majorant, source(x, y, z));
+						}
+					}
+				}
+				m_majorant[block] = majorant;
+
+				bool occupied = false;
+				for (int z = bz * blockSize; z < std::min((bz + 1) * blockSize, resZ) && !occupied; ++z)
+				{
+					for (int y = by * blockSize; y < std::min((by + 1) * blockSize, resY) && !occupied; ++y)
+					{
+						for (int x = bx * blockSize; x < std::min((bx + 1) * blockSize, resX) && !occupied; ++x)
+						{
+							occupied = source(x, y, z) > 0.0f;
+						}
+					}
+				}
+				if (!occupied) continue;
+
+				m_blockIndex[block] = allocated++;
+				for (int z = 0; z < blockSize; ++z)
+				{
+					for (int y = 0; y < blockSize; ++y)
+					{
+						for (int x = 0; x < blockSize; ++x)
+						{
+							m_blockData.push_back(source(bx * blockSize + x, by * blockSize + y, bz * blockSize + z));
+						}
+					}
+				}
+			}
+		}
+	}
+	m_blockData.shrink_to_fit();
+}
+
+float GridMedium::Voxel(int x, int y, int z) const
+{
+	x = std::min(std::max(x, 0), m_res[0] - 1);
+	y = std::min(std::max(y, 0), m_res[1] - 1);
+	z = std::min(std::max(z, 0), m_res[2] - 1);
+	const int block = ((z / blockSize) * m_blockCount[1] + y / blockSize) * m_blockCount[0] + x / blockSize;
+	const int index = m_blockIndex[block];
+	if (index < 0) return 0.0f;
+	return m_blockData[static_cast<size_t>(index) * blockSize * blockSize * blockSize
+		+ ((z % blockSize) * blockSize + y % blockSize) * blockSize + x % blockSize];
+}
+
+float GridMedium::GetSigmaT(const vector3 &p) const
+{
+	if (p.x < m_bounds.min.x || p.y < m_bounds.min.y || p.z < m_bounds.min.z
+		|| p.x > m_bounds.max.x || p.y > m_bounds.max.y || p.z > m_bounds.max.z)
+	{
+		return 0.0f;
+	}
+
+	// voxel values sit at the voxel centers
+	vector3 g = (p - m_bounds.min) / m_voxelSize - vector3(0.5f);
+	int x = static_cast<int>(std::floor(g.x));
+	int y = static_cast<int>(std::floor(g.y));
+	int z = static_cast<int>(std::floor(g.z));
+	float fx = g.x - x;
+	float fy = g.y - y;
+	float fz = g.z - z;
+
+	float d00 = lerp(Voxel(x, y, z), Voxel(x + 1, y, z), fx);
+	float d10 = lerp(Voxel(x, y + 1, z), Voxel(x + 1, y + 1, z), fx);
+	float d01 = lerp(Voxel(x, y, z + 1), Voxel(x + 1, y, z + 1), fx);
+	float d11 = lerp(Voxel(x, y + 1, z + 1), Voxel(x + 1, y + 1, z + 1), fx);
+	return lerp(lerp(d00, d10, fy), lerp(d01, d11, fy), fz);
+}
+
+template<typename F>
+void GridMedium::TraverseBlocks(const Ray &ray, float tMax, F fn) const
+{
+	Ray clipped(ray.origin, ray.direction);
+	clipped.tMax = tMax;
+	float t0, t1;
+	if (!m_bounds.Intersect(clipped, &t0, &t1)) return;
+
+	// 3D DDA in block units
+	const vector3 blockExtent = m_voxelSize * static_cast<float>(blockSize);
+	const vector3 o = (ray.origin - m_bounds.min) / blockExtent;
+	const vector3 d = ray.direction / blockExtent;
+	const float origin[3] = { o.x, o.y, o.z };
+	const float direction[3] = { d.x, d.y, d.z };
+
+	int cell[3];
+	int step[3];
+	float tNext[3];
+	float tDelta[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float p = origin[axis] + direction[axis] * t0;
+		cell[axis] = std::min(std::max(static_cast<int>(std::floor(p)), 0), m_blockCount[axis] - 1);
+		if (direction[axis] > 0.0f)
+		{
+			step[axis] = 1;
+			tNext[axis] = (cell[axis] + 1 - origin[axis]) / direction[axis];
+			tDelta[axis] = 1.0f / direction[axis];
+		}
+		else if (direction[axis] < 0.0f)
+		{
+			step[axis] = -1;
+			tNext[axis] = (cell[axis] - origin[axis]) / direction[axis];
+			tDelta[axis] = -1.0f / direction[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			tNext[axis] = std::numeric_limits<float>::infinity();
+			tDelta[axis] = std::numeric_limits<float>::infinity();
+		}
+	}
+
+	float tEnter = t0;
+	while (tEnter < t1)
+	{
+		int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		float tExit = std::min(tNext[axis], t1);
+		float majorant = m_majorant[(cell[2] * m_blockCount[1] + cell[1]) * m_blockCount[0] + cell[0]];
+		if (majorant > 0.0f && tExit > tEnter && !fn(tEnter, tExit, majorant)) return;
+
+		tEnter = tExit;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= m_blockCount[axis]) return;
+		tNext[axis] += tDelta[axis];
+	}
+}
+
+bool GridMedium::SampleCollision(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis, float *t) const
+{
+	bool collided = false;
+	TraverseBlocks(ray, tMax, [&](float tEnter, float tExit, float majorant)
+	{
+		// tentative collisions against the majorant, the exponential is memoryless so every block starts afresh
+		float tCollision = tEnter;
+		while (true)
+		{
+			tCollision += sampleExponential(dis(gen), majorant);
+			if (tCollision >= tExit) return true;
+			if (dis(gen) * majorant < GetSigmaT(ray.origin + ray.direction * tCollision))
+			{
+				*t = tCollision;
+				collided = true;
+				return false;
+			}
+		}
+	});
+	return collided;
+}
+
+float GridMedium::Transmittance(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis) const
+{
+	float transmittance = 1.0f;
+	TraverseBlocks(ray, tMax, [&](float tEnter, float tExit, float majorant)
+	{
+		float tCollision = tEnter;
+		while (true)
+		{
+			tCollision += sampleExponential(dis(gen), majorant);
+			if (tCollision >= tExit) return true;
+			transmittance *= 1.0f - GetSigmaT(ray.origin + ray.direction * tCollision) / majorant;
+			if (transmittance < rouletteTransmittance)
+			{
+				// survivors are weighted back up to 1
+				if (dis(gen) >= transmittance)
+				{
+					transmittance = 0.0f;
+					return false;
+				}
+				transmittance = 1.0f;
+			}
+		}
+	});
+	return transmittance;
+}
+
+size_t GridMedium::GetMemoryBytes() const
+{
+	return sizeof(*this) + m_blockIndex.capacity() * sizeof(int32_t) + m_blockData.capacity() * sizeof(float)
+		+ m_majorant.capacity() * sizeof(float);
+}
+
+float henyeyGreenstein(float cosTheta, float g)
+{
+	float denom = 1.0f + g * g - 2.0f * g * cosTheta;
+	return 0.25f * rcpPi * (1.0f - g * g) / (denom * std::sqrt(denom));
+}
+
+vector3 sampleHenyeyGreenstein(const vector3 &direction, float g, float e0, float e1)
+{
+	float cosTheta;
+	if (std::abs(g) < 1e-3f)
+	{
+		cosTheta = 1.0f - 2.0f * e0;
+	}
+	else
+	{
+		float s = (1.0f - g * g) / (1.0f - g + 2.0f * g * e0);
+		cosTheta = clamp((1.0f + g * g - s * s) / (2.0f * g), -1.0f, 1.0f);
+	}
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * pi * e1;
+
+	vector3 tangent;
+	vector3 binormal;
+	coordinateSystem(direction, &tangent, &binormal);
+	return tangent * (sinTheta * std::cos(phi)) + binormal * (sinTheta * std::sin(phi)) + direction * cosTheta;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bounds.h"
+#include "math.h"
+#include "ray.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Participating medium with a gray extinction coefficient, the color comes from the single
+// scattering albedo. Distances are measured in ray parameters, so ray directions must be normalized.
+class Medium
+{
+public:
+	Medium(vector3 albedo_, float g_): albedo(albedo_), g(g_) {}
+	virtual ~Medium() {}
+
+	// Delta tracking along [0, tMax]. Returns true and the distance of a real collision in t, false
+	// if the ray leaves the interval. Real collisions scatter with probability albedo.
+	virtual bool SampleCollision(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis, float *t) const = 0;
+	// Unbiased transmittance estimate along [0, tMax], ratio tracking where it is not known in closed form.
+	virtual float Transmittance(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis) const = 0;
+	virtual size_t GetMemoryBytes() const = 0;
+
+	vector3 albedo;
+	float g; // Henyey-Greenstein asymmetry, 0 scatters uniformly, positive values forward
+};
+
+class HomogeneousMedium: public Medium
+{
+public:
+	HomogeneousMedium(float sigmaT, vector3 albedo, float g): Medium(albedo, g), m_sigmaT(sigmaT) {}
+
+	bool SampleCollision(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis, float *t) const override;
+	float Transmittance(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis) const override;
+	size_t GetMemoryBytes() const override { return sizeof(*this); }
+
+private:
+	float m_sigmaT;
+};
+
+// Heterogeneous medium sampled from a voxel grid spanning bounds. Voxels are stored in 8^3 blocks
+// that are only allocated where the density is non zero, every block also keeps the majorant of the
+// densities that can be interpolated inside it. Tracking walks the blocks front to back and skips
+// blocks with a zero majorant entirely.
+class GridMedium: public Medium
+{
+public:
+	static const int blockSize = 8;
+
+	// density holds resX * resY * resZ voxels with x running fastest, sigmaScale turns it into extinction.
+	GridMedium(const AABB &bounds, int resX, int resY, int resZ, const std::vector<float> &density, float sigmaScale, vector3 albedo, float g);
+
+	bool SampleCollision(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis, float *t) const override;
+	float Transmittance(const Ray &ray, float tMax, std::minstd_rand &gen, std::uniform_real_distribution<float> &dis) const override;
+	size_t GetMemoryBytes() const override;
+
+	// Trilinearly interpolated extinction at p, zero outside the bounds.
+	float GetSigmaT(const vector3 &p) const;
+	size_t GetAllocatedBlockCount() const { return m_blockData.size() / (blockSize * blockSize * blockSize); }
+
+private:
+	float Voxel(int x, int y, int z) const;
+	// Calls fn(tEnter, tExit, majorant) for every block the ray passes in [0, tMax] with a non zero
+	// majorant, front to back, until fn returns false.
+	template<typename F>
+	void TraverseBlocks(const Ray &ray, float tMax, F fn) const;
+
+	AABB m_bounds;
+	int m_res[3];
+	int m_blockCount[3];
+	vector3 m_voxelSize;
+	std::vector<int32_t> m_blockIndex; // -1 for blocks without any density
+	std::vector<float> m_blockData; // extinction, blockSize^3 voxels per allocated block
+	std::vector<float> m_majorant; // per block, including the neighbours trilinear lookups reach
+};
+
+// Phase function, cosTheta is the cosine between the propagation directions before and after scattering.
+float henyeyGreenstein(float cosTheta, float g);
+// Samples the propagation direction after scattering a ray travelling along direction. The sample
+// is distributed exactly like the phase function, so its weight is 1.
+vector3 sampleHenyeyGreenstein(const vector3 &direction, float g, float e0, float e1);
@@ -0,0 +1,258 @@
+#include "mesh.h"
+#include "hit.h"
+
+#include <algorithm>
+#include <cmath>
+
+static float signNotZero(float v)
+{
+	return v < 0.0f ? -1.0f : 1.0f;
+}
+
+// Octahedral mapping: project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over.
+static void encodeOctahedral(const vector3 &n, int16_t *u, int16_t *v)
+{
+	float rcpNorm = 1.0f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	float px = n.x * rcpNorm;
+	float py = n.y * rcpNorm;
+	if (n.z < 0.0f)
+	{
+		float fx = (1.0f - std::abs(py)) * signNotZero(px);
+		float fy = (1.0f - std::abs(px)) * signNotZero(py);
+		px = fx;
+		py = fy;
+	}
+	*u = static_cast<int16_t>(std::round(clamp(px, -1.0f, 1.0f) * 32767.0f));
+	*v = static_cast<int16_t>(std::round(clamp(py, -1.0f, 1.0f) * 32767.0f));
+}
+
+static vector3 decodeOctahedral(int16_t u, int16_t v)
+{
+	float px = u / 32767.0f;
+	float py = v / 32767.0f;
+	vector3 n(px, py, 1.0f - std::abs(px) - std::abs(py));
+	if (n.z < 0.0f)
+	{
+		n.x = (1.0f - std::abs(py)) * signNotZero(px);
+		n.y = (1.0f - std::abs(px)) * signNotZero(py);
+	}
+	return n.normalized();
+}
+
+TriangleMesh::TriangleMesh(const std::vector<vector3> &positions, const std::vector<vector3> &normals, const std::vector<uint32_t> &indices, bool compress)
+	: m_compressed(compress)
+	, m_triangleCount(indices.size() / 3)
+{
+	AABB meshBounds;
+	for (const vector3 &p : positions)
+	{
+		meshBounds.Expand(p);
+	}
+
+	if (compress)
+	{
+		m_quantizationOrigin = meshBounds.min;
+		vector3 extent = meshBounds.Extent();
+		m_quantizationScale = vector3(std::max(extent.x, 1e-20f), std::max(extent.y, 1e-20f), std::max(extent.z, 1e-20f)) / 65535.0f;
+		m_packedPositions.reserve(positions.size() * 3);
+		for (const vector3 &p : positions)
+		{
+			vector3 q = (p - m_quantizationOrigin) / m_quantizationScale;
+			m_packedPositions.push_back(static_cast<uint16_t>(clamp(std::round(q.x), 0.0f, 65535.0f)));
+			m_packedPositions.push_back(static_cast<uint16_t>(clamp(std::round(q.y), 0.0f, 65535.0f)));
+			m_packedPositions.push_back(static_cast<uint16_t>(clamp(std::round(q.z), 0.0f, 65535.0f)));
+		}
+		m_packedNormals.resize(normals.size() * 2);
+		for (size_t i = 0; i < normals.size(); ++i)
+		{
+			encodeOctahedral(normals[i], &m_packedNormals[i * 2], &m_packedNormals[i * 2 + 1]);
+		}
+	}
+	else
+	{
+		m_positions = positions;
+		m_normals = normals;
+	}
+
+	// bounds from the stored (possibly quantized) positions so the BVH matches what is intersected
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<AABB> bounds(triangleCount);
+	for (size_t i = 0; i < triangleCount; ++i)
+	{
+		bounds[i].Expand(GetPosition(indices[i * 3 + 0]));
+		bounds[i].Expand(GetPosition(indices[i * 3 + 1]));
+		bounds[i].Expand(GetPosition(indices[i * 3 + 2]));
+	}
+	std::vector<uint32_t> order = m_bvh.Build(bounds, compress ? 2 * CompressedBVH::maxLeafSize : CompressedBVH::maxLeafSize);
+	m_indices.reserve(triangleCount * 3);
+	for (uint32_t triangle : order)
+	{
+		m_indices.push_back(indices[triangle * 3 + 0]);
+		m_indices.push_back(indices[triangle * 3 + 1]);
+		m_indices.push_back(indices[triangle * 3 + 2]);
+	}
+	if (compress)
+	{
+		CompressIndices();
+	}
+}
+
+void TriangleMesh::CompressIndices()
+{
+	// number the vertices by first use, neighbouring triangles then refer to nearby numbers
+	const size_t vertexCount = m_packedPositions.size() / 3;
+	std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	std::vector<uint32_t> vertices; // old number of every new one
+	vertices.reserve(vertexCount);
+	for (uint32_t &index : m_indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(index);
+		}
+		index = remap[index];
+	}
+
+	std::vector<uint16_t> positions(vertices.size() * 3);
+	std::vector<int16_t> normals(m_packedNormals.empty() ? 0 : vertices.size() * 2);
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		std::copy_n(&m_packedPositions[vertices[i] * 3], 3, &positions[i * 3]);
+		if (!normals.empty())
+		{
+			std::copy_n(&m_packedNormals[vertices[i] * 2], 2, &normals[i * 2]);
+		}
+	}
+	m_packedPositions = std::move(positions);
+	m_packedNormals = std::move(normals);
+
+	// bases hold a flag in their top bit
+	if (vertices.size() > wideGroup) return;
+
+	const size_t groupIndices = indexGroupSize * 3;
+	m_localIndices.resize(m_indices.size());
+	for (size_t first = 0; first < m_indices.size(); first += groupIndices)
+	{
+		const auto begin = m_indices.begin() + first;
+		const auto end = m_indices.begin() + std::min(first + groupIndices, m_indices.size());
+		const auto range = std::minmax_element(begin, end);
+		if (*range.second - *range.first > UINT16_MAX)
+		{
+			// a vertex first used far back in the order, the group keeps its plain indices
+			m_indexBases.push_back(wideGroup | static_cast<uint32_t>(m_wideIndices.size()));
+			m_wideIndices.insert(m_wideIndices.end(), begin, end);
+			continue;
+		}
+		m_indexBases.push_back(*range.first);
+		for (auto it = begin; it != end; ++it)
+		{
+			m_localIndices[it - m_indices.begin()] = static_cast<uint16_t>(*it - *range.first);
+		}
+	}
+	m_wideIndices.shrink_to_fit();
+	m_indices = std::vector<uint32_t>();
+}
+
+vector3 TriangleMesh::GetPosition(uint32_t vertex) const
+{
+	if (!m_compressed) return m_positions[vertex];
+	const uint16_t *q = &m_packedPositions[vertex * 3];
+	return m_quantizationOrigin + vector3(q[0], q[1], q[2]) * m_quantizationScale;
+}
+
+vector3 TriangleMesh::GetNormal(uint32_t vertex) const
+{
+	if (!m_compressed) return m_normals[vertex];
+	return decodeOctahedral(m_packedNormals[vertex * 2], m_packedNormals[vertex * 2 + 1]);
+}
+
+bool TriangleMesh::IntersectTriangle(uint32_t triangle, const Ray &r, float *t, float *b1, float *b2) const
+{
+	// Moller-Trumbore
+	const vector3 p0 = GetPosition(GetIndex(triangle * 3 + 0));
+	const vector3 e1 = GetPosition(GetIndex(triangle * 3 + 1)) - p0;
+	const vector3 e2 = GetPosition(GetIndex(triangle * 3 + 2)) - p0;
+	const vector3 pv = r.direction.cross(e2);
+	const float det = e1.dot(pv);
+	if (std::abs(det) < 1e-12f) return false;
+
+	const float rcpDet = 1.0f / det;
+	const vector3 tv = r.origin - p0;
+	const float u = tv.dot(pv) * rcpDet;
+	if (u < 0.0f || u > 1.0f) return false;
+	const vector3 qv = tv.cross(e1);
+	const float v = r.direction.dot(qv) * rcpDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	const float tHit = e2.dot(qv) * rcpDet;
+	if (tHit <= 0.0f || tHit >= r.tMax) return false;
+	*t = tHit;
+	*b1 = u;
+	*b2 = v;
+	return true;
+}
+
+bool TriangleMesh::Intersect(const Ray &r, float *t, Hit *h)
+{
+	// local copy, the caller's tMax is only updated by the primitive once the nearest hit is known
+	Ray ray = r;
+	uint32_t hitTriangle = 0;
+	float hitB1 = 0.0f;
+	float hitB2 = 0.0f;
+	bool found = m_bvh.Traverse(ray, [&](uint32_t triangle)
+	{
+		float tHit;
+		float b1;
+		float b2;
+		if (!IntersectTriangle(triangle, ray, &tHit, &b1, &b2)) return false;
+		ray.tMax = tHit;
+		hitTriangle = triangle;
+		hitB1 = b1;
+		hitB2 = b2;
+		return true;
+	});
+	if (!found) return false;
+
+	*t = ray.tMax;
+	if (h)
+	{
+		const uint32_t i0 = GetIndex(hitTriangle * 3 + 0);
+		const uint32_t i1 = GetIndex(hitTriangle * 3 + 1);
+		const uint32_t i2 = GetIndex(hitTriangle * 3 + 2);
+		h->position = r.origin + r.direction * ray.tMax;
+		vector3 faceNormal = (GetPosition(i1) - GetPosition(i0)).cross(GetPosition(i2) - GetPosition(i0));
+		if (HasNormals())
+		{
+			h->normal = (GetNormal(i0) * (1.0f - hitB1 - hitB2) + GetNormal(i1) * hitB1 + GetNormal(i2) * hitB2).normalized();
+		}
+		else
+		{
+			h->normal = faceNormal.normalized();
+		}
+		h->u = hitB1;
+		h->v = hitB2;
+		// barycentrics run from 0 to 1 over roughly the square root of twice the triangle area
+		h->uvDensity = 1.0f / std::sqrt(std::max(faceNormal.length(), 1e-20f));
+	}
+	return true;
+}
+
+bool TriangleMesh::Occluded(const Ray &r)
+{
+	return m_bvh.Occluded(r, [&](uint32_t triangle)
+	{
+		float tHit;
+		float b1;
+		float b2;
+		return IntersectTriangle(triangle, r, &tHit, &b1, &b2);
+	});
+}
+
+size_t TriangleMesh::GetMemoryBytes() const
+{
+	return sizeof(*this) + m_bvh.GetMemoryBytes() + (m_indices.capacity() + m_indexBases.capacity() + m_wideIndices.capacity()) * sizeof(uint32_t)
+		+ m_localIndices.capacity() * sizeof(uint16_t)
+		+ (m_positions.capacity() + m_normals.capacity()) * sizeof(vector3)
+		+ m_packedPositions.capacity() * sizeof(uint16_t) + m_packedNormals.capacity() * sizeof(int16_t);
+}
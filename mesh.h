@@ -0,0 +1,64 @@
+#pragma once
+
+#include "bvh.h"
+#include "shape.h"
+
+#include <cstdint>
+#include <vector>
+
+// Indexed triangle mesh with its own BVH over the triangles. With compress set, positions are
+// stored as 16 bit offsets inside the mesh bounds and normals as 2 x 16 bit octahedral vectors,
+// 10 instead of 24 bytes per vertex. Vertices are then renumbered in the order the BVH leaves
+// first use them, so indices are 16 bit offsets from a base per group of triangles, and leaves
+// hold up to twice as many triangles.
+class TriangleMesh: public Shape
+{
+public:
+	// normals may be empty, the mesh is then shaded with face normals
+	TriangleMesh(const std::vector<vector3> &positions, const std::vector<vector3> &normals, const std::vector<uint32_t> &indices, bool compress);
+	~TriangleMesh() override {}
+	bool Intersect(const Ray &r, float *t, Hit *h) override;
+	bool Occluded(const Ray &r) override;
+	std::unique_ptr<Shape> Clone() const override { return std::make_unique<TriangleMesh>(*this); }
+	AABB GetBounds() const override { return m_bvh.GetBounds(); }
+	size_t GetMemoryBytes() const override;
+	size_t GetPrimitiveCount() const override { return m_triangleCount; }
+
+	// vertex numbers are the mesh's own, compressed meshes renumber their vertices
+	vector3 GetPosition(uint32_t vertex) const;
+	vector3 GetNormal(uint32_t vertex) const;
+	bool HasNormals() const { return !m_normals.empty() || !m_packedNormals.empty(); }
+
+private:
+	static const int indexGroupSize = 16; // triangles sharing an index base
+	static const uint32_t wideGroup = 0x80000000u; // marks a base that points into m_wideIndices instead
+
+	bool IntersectTriangle(uint32_t triangle, const Ray &r, float *t, float *b1, float *b2) const;
+	void CompressIndices();
+	// i-th index of the triangles in BVH leaf order
+	uint32_t GetIndex(size_t i) const
+	{
+		if (m_indexBases.empty()) return m_indices[i];
+		const uint32_t base = m_indexBases[i / (indexGroupSize * 3)];
+		if (base & wideGroup) return m_wideIndices[(base & ~wideGroup) + i % (indexGroupSize * 3)];
+		return base + m_localIndices[i];
+	}
+
+	bool m_compressed;
+	size_t m_triangleCount;
+	// three per triangle in BVH leaf order, either plain or as offsets from a base per group. The few
+	// groups spanning more than 16 bits of vertices keep plain indices in m_wideIndices
+	std::vector<uint32_t> m_indices;
+	std::vector<uint32_t> m_indexBases;
+	std::vector<uint16_t> m_localIndices;
+	std::vector<uint32_t> m_wideIndices;
+	CompressedBVH m_bvh;
+
+	std::vector<vector3> m_positions;
+	std::vector<vector3> m_normals;
+
+	vector3 m_quantizationOrigin;
+	vector3 m_quantizationScale;
+	std::vector<uint16_t> m_packedPositions; // x, y, z per vertex
+	std::vector<int16_t> m_packedNormals; // octahedral u, v per vertex
+};
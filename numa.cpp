@@ -0,0 +1,173 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// parses the kernel cpulist format, e.g. "0-7,16-23"
+static std::vector<int> parseCpuList(const std::string &list)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ','))
+	{
+		if (range.empty() || range[0] == '\n') continue;
+		size_t dash = range.find('-');
+		int first = std::stoi(range.substr(0, dash));
+		int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+NumaTopology NumaTopology::Detect()
+{
+	NumaTopology topology;
+
+#ifdef __linux__
+	// taskset, cpusets and container limits leave the process only part of the machine
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	const bool hasAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+	auto isAllowed = [&](int cpu)
+	{
+		return !hasAffinity || (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+	};
+
+	for (int node = 0; ; ++node)
+	{
+		std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!f) break;
+
+		std::string list;
+		std::getline(f, list);
+		std::vector<int> cpus = parseCpuList(list);
+		cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](int cpu) { return !isAllowed(cpu); }), cpus.end());
+		// memory-only nodes, and nodes the process may not run on, have no CPUs for workers
+		if (!cpus.empty())
+		{
+			topology.m_nodeCpus.push_back(std::move(cpus));
+		}
+	}
+
+	if (topology.m_nodeCpus.empty() && hasAffinity)
+	{
+		std::vector<int> cpus;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+		}
+		if (!cpus.empty())
+		{
+			topology.m_nodeCpus.push_back(std::move(cpus));
+		}
+	}
+#endif
+
+	if (topology.m_nodeCpus.empty())
+	{
+		std::vector<int> cpus;
+		unsigned int count = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int cpu = 0; cpu < count; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+		topology.m_nodeCpus.push_back(std::move(cpus));
+	}
+
+	return topology;
+}
+
+int NumaTopology::GetCpuCount() const
+{
+	int count = 0;
+	for (auto &cpus : m_nodeCpus)
+	{
+		count += static_cast<int>(cpus.size());
+	}
+	return count;
+}
+
+bool PinCurrentThread(int cpu)
+{
+	return PinCurrentThread(std::vector<int>{ cpu });
+}
+
+bool PinCurrentThread(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+	{
+		if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpus;
+	return false;
+#endif
+}
+
+NodeBuffer::NodeBuffer(size_t count, int node): m_count(count), m_bytes(count * sizeof(float))
+{
+#ifdef __linux__
+	void *data = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+	{
+		throw std::bad_alloc();
+	}
+#ifdef SYS_mbind
+	if (node >= 0 && node < 64)
+	{
+		// same call libnuma makes, MPOL_PREFERRED rather than MPOL_BIND so a full node spills over instead of failing
+		const int mpolPreferred = 1;
+		unsigned long nodeMask = 1ul << node;
+		syscall(SYS_mbind, data, m_bytes, mpolPreferred, &nodeMask, sizeof(nodeMask) * 8, 0);
+	}
+#endif
+	m_data = static_cast<float *>(data);
+#else
+	(void)node;
+	m_data = new float[count];
+#endif
+}
+
+NodeBuffer::~NodeBuffer()
+{
+	if (!m_data) return;
+#ifdef __linux__
+	munmap(m_data, m_bytes);
+#else
+	delete[] m_data;
+#endif
+}
+
+NodeBuffer::NodeBuffer(NodeBuffer &&o)
+{
+	*this = std::move(o);
+}
+
+NodeBuffer &NodeBuffer::operator=(NodeBuffer &&o)
+{
+	std::swap(m_data, o.m_data);
+	std::swap(m_count, o.m_count);
+	std::swap(m_bytes, o.m_bytes);
+	return *this;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// CPU layout of the machine as reported by /sys/devices/system/node, limited to the CPUs the
+// process may run on. Machines without that information (or with a single node) report one node
+// holding every allowed CPU.
+class NumaTopology
+{
+public:
+	static NumaTopology Detect();
+
+	int GetNodeCount() const { return static_cast<int>(m_nodeCpus.size()); }
+	bool IsNuma() const { return m_nodeCpus.size() > 1; }
+	const std::vector<int> &GetCpus(int node) const { return m_nodeCpus[node]; }
+	int GetCpuCount() const;
+
+private:
+	std::vector<std::vector<int>> m_nodeCpus;
+};
+
+// Pins the calling thread to one CPU, returns false if the platform does not support it.
+bool PinCurrentThread(int cpu);
+// Same for a set of CPUs the thread may move between.
+bool PinCurrentThread(const std::vector<int> &cpus);
+
+// Page aligned allocation whose physical pages are bound to one node. With node < 0, or on
+// platforms without NUMA support, it is a plain allocation that ends up wherever it is first touched.
+class NodeBuffer
+{
+public:
+	NodeBuffer() {}
+	NodeBuffer(size_t count, int node);
+	~NodeBuffer();
+	NodeBuffer(NodeBuffer &&o);
+	NodeBuffer &operator=(NodeBuffer &&o);
+	NodeBuffer(const NodeBuffer &) = delete;
+	NodeBuffer &operator=(const NodeBuffer &) = delete;
+
+	float *GetData() const { return m_data; }
+	size_t GetCount() const { return m_count; }
+
+private:
+	float *m_data = nullptr;
+	size_t m_count = 0;
+	size_t m_bytes = 0;
+};
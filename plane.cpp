@@ -3,6 +3,13 @@
 
 #include <iostream>
 
+Plane::Plane(vector3 normal_, float d_, float uvScale_): normal(normal_), d(d_), uvScale(uvScale_)
+{
+	vector3 axis = std::abs(normal.x) < 0.9f ? vector3(1.0f, 0.0f, 0.0f) : vector3(0.0f, 1.0f, 0.0f);
+	binormal = normal.cross(axis).normalized();
+	tangent = binormal.cross(normal);
+}
+
 bool Plane::Intersect(const Ray &r, float *t, Hit *h)
 {
 	float denom = r.direction.dot(normal);
@@ -16,6 +23,9 @@ bool Plane::Intersect(const Ray &r, float *t, Hit *h)
 			{
 				h->position = r.origin + r.direction * (*t);
 				h->normal = normal;
+				h->u = h->position.dot(tangent) * uvScale;
+				h->v = h->position.dot(binormal) * uvScale;
+				h->uvDensity = uvScale;
 			}
 			return true;
 		}
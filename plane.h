@@ -4,11 +4,17 @@
 class Plane: public Shape
 {
 public:
-	Plane(vector3 normal_, float d_): normal(normal_), d(d_) {}
+	Plane(vector3 normal_, float d_, float uvScale_ = 1.0f);
 	virtual ~Plane() {}
 	virtual bool Intersect(const Ray &r, float *t, Hit *h) override;
+	std::unique_ptr<Shape> Clone() const override { return std::make_unique<Plane>(*this); }
+	AABB GetBounds() const override { return AABB::Infinite(); }
+	size_t GetMemoryBytes() const override { return sizeof(*this); }
 
 	vector3 normal;
 	float d;
+	float uvScale; // uv units per world unit along the plane
+	vector3 tangent;
+	vector3 binormal;
 };
 
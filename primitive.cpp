@@ -4,7 +4,7 @@
 
 #include <memory>
 
-GeometricPrimitive::GeometricPrimitive(std::unique_ptr<Shape> &&shape, Material *m): m_material(m)
+GeometricPrimitive::GeometricPrimitive(std::unique_ptr<Shape> &&shape, Material *m, const Medium *interior): m_material(m), m_interior(interior)
 {
 	m_shape = std::move(shape);
 }
@@ -25,6 +25,36 @@ bool GeometricPrimitive::Intersect(const Ray &r, Hit *hit) const
 	return true;
 }
 
+bool GeometricPrimitive::Occluded(const Ray &r, const Primitive **occluder) const
+{
+	if (!m_shape->Occluded(r)) return false;
+	if (occluder)
+	{
+		*occluder = this;
+	}
+	return true;
+}
+
+std::unique_ptr<Primitive> GeometricPrimitive::Clone() const
+{
+	return std::make_unique<GeometricPrimitive>(m_shape->Clone(), m_material, m_interior);
+}
+
+AABB GeometricPrimitive::GetBounds() const
+{
+	return m_shape->GetBounds();
+}
+
+size_t GeometricPrimitive::GetMemoryBytes() const
+{
+	return sizeof(*this) + m_shape->GetMemoryBytes();
+}
+
+size_t GeometricPrimitive::GetPrimitiveCount() const
+{
+	return m_shape->GetPrimitiveCount();
+}
+
 LoosePrimitives::LoosePrimitives(std::vector<std::unique_ptr<Primitive>> &&prims)
 {
 	m_primitives = std::move(prims);
@@ -46,3 +76,52 @@ bool LoosePrimitives::Intersect(const Ray &r, Hit *hit) const
 	}
 	return result;
 }
+
+bool LoosePrimitives::Occluded(const Ray &r, const Primitive **occluder) const
+{
+	for (auto &primitive : m_primitives)
+	{
+		if (primitive->Occluded(r, occluder)) return true;
+	}
+	return false;
+}
+
+std::unique_ptr<Primitive> LoosePrimitives::Clone() const
+{
+	std::vector<std::unique_ptr<Primitive>> prims;
+	for (auto &primitive : m_primitives)
+	{
+		prims.push_back(primitive->Clone());
+	}
+	return std::make_unique<LoosePrimitives>(std::move(prims));
+}
+
+AABB LoosePrimitives::GetBounds() const
+{
+	AABB bounds;
+	for (auto &primitive : m_primitives)
+	{
+		bounds.Expand(primitive->GetBounds());
+	}
+	return bounds;
+}
+
+size_t LoosePrimitives::GetMemoryBytes() const
+{
+	size_t bytes = sizeof(*this) + m_primitives.capacity() * sizeof(std::unique_ptr<Primitive>);
+	for (auto &primitive : m_primitives)
+	{
+		bytes += primitive->GetMemoryBytes();
+	}
+	return bytes;
+}
+
+size_t LoosePrimitives::GetPrimitiveCount() const
+{
+	size_t count = 0;
+	for (auto &primitive : m_primitives)
+	{
+		count += primitive->GetPrimitiveCount();
+	}
+	return count;
+}
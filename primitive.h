@@ -10,26 +10,45 @@
 class Hit;
 class Shape;
 class Material;
+class Medium;
 
 class Primitive
 {
 public:
 	virtual ~Primitive() {};
 	virtual bool Intersect(const Ray &r, Hit *hit) const = 0;
+	// True for any hit closer than r.tMax, without looking for the nearest one or touching tMax.
+	// occluder, if given, receives the primitive that was hit.
+	virtual bool Occluded(const Ray &r, const Primitive **occluder) const = 0;
 	virtual Material *GetMaterial() const = 0;
+	// Medium inside the closed surface, rays that cross the surface towards its back side enter it.
+	virtual const Medium *GetInterior() const { return nullptr; }
+	// Deep copy of the geometry, materials are shared. Used to give every NUMA node its own replica.
+	virtual std::unique_ptr<Primitive> Clone() const = 0;
+	virtual AABB GetBounds() const = 0;
+	virtual size_t GetMemoryBytes() const = 0;
+	virtual size_t GetPrimitiveCount() const = 0;
 };
 
 class GeometricPrimitive: public Primitive
 {
 public:
-	GeometricPrimitive(std::unique_ptr<Shape> &&shape, Material *m);
+	// Without a material the surface is invisible and only bounds the interior medium.
+	GeometricPrimitive(std::unique_ptr<Shape> &&shape, Material *m, const Medium *interior = nullptr);
 	~GeometricPrimitive() override;
 	bool Intersect(const Ray &r, Hit *hit) const override;
+	bool Occluded(const Ray &r, const Primitive **occluder) const override;
 	Material *GetMaterial() const override { return m_material; }
+	const Medium *GetInterior() const override { return m_interior; }
+	std::unique_ptr<Primitive> Clone() const override;
+	AABB GetBounds() const override;
+	size_t GetMemoryBytes() const override;
+	size_t GetPrimitiveCount() const override;
 
 private:
 	std::unique_ptr<Shape> m_shape;
 	Material *m_material;
+	const Medium *m_interior;
 };
 
 class LoosePrimitives: public Primitive
@@ -38,7 +57,12 @@ public:
 	LoosePrimitives(std::vector<std::unique_ptr<Primitive>> &&prims);
 	~LoosePrimitives() override;
 	bool Intersect(const Ray &r, Hit *hit) const override;
+	bool Occluded(const Ray &r, const Primitive **occluder) const override;
 	Material *GetMaterial() const override {return nullptr; };
+	std::unique_ptr<Primitive> Clone() const override;
+	AABB GetBounds() const override;
+	size_t GetMemoryBytes() const override;
+	size_t GetPrimitiveCount() const override;
 
 private:
 	std::vector<std::unique_ptr<Primitive>> m_primitives;
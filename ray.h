@@ -9,8 +9,13 @@ class Ray
 public:
 	Ray(vector3 o, vector3 d): origin(o), direction(d), tMax(std::numeric_limits<float>::infinity()) {}
 	vector3 GetPoint();
+	// Width of the ray cone at t, the world space footprint the ray stands for.
+	float GetFootprint(float t) const { return coneWidth + coneSpread * t; }
 
 	vector3 origin;
 	vector3 direction;
 	mutable float tMax;
+	float coneWidth = 0.0f;
+	float coneSpread = 0.0f; // radians, grows with every rough bounce
+	bool coarse = false; // the path is blurry enough for shapes to trade precision for speed
 };
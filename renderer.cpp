@@ -0,0 +1,644 @@
+#include "renderer.h"
+#include "camera.h"
+#include "envmap.h"
+#include "guiding.h"
+#include "integrator.h"
+#include "primitive.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <random>
+
+int RenderSettings::GetSampleCount(int x, int y) const
+{
+	for (auto region = sampleRegions.rbegin(); region != sampleRegions.rend(); ++region)
+	{
+		if (region->rect.Contains(x, y))
+		{
+			return region->sampleCount;
+		}
+	}
+	return sampleCount;
+}
+
+// Scales the frame, the crop and the sample regions down to the preview resolution and fills in an
+// empty crop with the whole frame.
+static RenderSettings resolveSettings(const RenderSettings &settings)
+{
+	RenderSettings resolved = settings;
+	const int scale = std::max(1, settings.previewScale);
+	resolved.previewScale = 1;
+	resolved.width = std::max(1, settings.width / scale);
+	resolved.height = std::max(1, settings.height / scale);
+
+	// rounds outwards, so a window still covers the preview pixels it touches
+	auto scaleRect = [&](const PixelRect &rect)
+	{
+		PixelRect scaled;
+		scaled.x1 = std::clamp(rect.x1 / scale, 0, resolved.width);
+		scaled.y1 = std::clamp(rect.y1 / scale, 0, resolved.height);
+		scaled.x2 = std::clamp((rect.x2 + scale - 1) / scale, 0, resolved.width);
+		scaled.y2 = std::clamp((rect.y2 + scale - 1) / scale, 0, resolved.height);
+		return scaled;
+	};
+	if (settings.crop.IsEmpty())
+	{
+		resolved.crop = { 0, 0, resolved.width, resolved.height };
+	}
+	else
+	{
+		resolved.crop = scaleRect(settings.crop);
+	}
+	for (SampleRegion &region : resolved.sampleRegions)
+	{
+		region.rect = scaleRect(region.rect);
+	}
+	return resolved;
+}
+
+SceneReplicas::SceneReplicas(const Scene &scene, int nodeCount)
+	: m_scene(scene)
+	, m_replicas(std::make_unique<Replica[]>(nodeCount))
+{
+}
+
+SceneReplicas::~SceneReplicas()
+{
+}
+
+const Scene &SceneReplicas::Get(int node)
+{
+	Replica &replica = m_replicas[node];
+	if (replica.state.load(std::memory_order_acquire) == State::Ready)
+	{
+		return *replica.scene;
+	}
+	State expected = State::Empty;
+	if (!replica.state.compare_exchange_strong(expected, State::Building))
+	{
+		return m_scene;
+	}
+
+	// the caller is pinned to the node, first touch places the copy there
+	replica.aggregate = m_scene.m_aggregate.Clone();
+	replica.scene = std::make_unique<Scene>(*replica.aggregate, m_scene.m_lights);
+	replica.scene->m_skyMaterial = m_scene.m_skyMaterial;
+	replica.scene->m_medium = m_scene.m_medium;
+	replica.scene->m_environment = m_scene.m_environment;
+	replica.scene->m_hasInteriors = m_scene.m_hasInteriors;
+	replica.state.store(State::Ready, std::memory_order_release);
+	return *replica.scene;
+}
+
+RenderJob::RenderJob(const Scene &scene, const RenderSettings &settings, TileCallback onTile, const NumaTopology &topology, int workerCount,
+	std::shared_ptr<SceneReplicas> replicas)
+	: m_scene(scene)
+	, m_settings(resolveSettings(settings))
+	, m_requestedSettings(settings)
+	, m_onTile(std::move(onTile))
+	, m_workerCount(workerCount)
+	, m_replicas(std::move(replicas))
+	, m_future(m_promise.get_future().share())
+{
+	const bool numaAware = topology.IsNuma(); // everything below degrades to the plain path on one node
+	const int nodeCount = topology.GetNodeCount();
+	// only the crop window is split into tiles, everything else is never dispatched
+	const PixelRect &crop = m_settings.crop;
+	const int cropW = std::max(0, crop.x2 - crop.x1);
+	const int cropH = std::max(0, crop.y2 - crop.y1);
+
+	m_tileSize = TileScheduler::ChooseTileSize(std::max(cropW, 1), std::max(cropH, 1), workerCount);
+	const int tileWidth = m_tileSize;
+	const int tileHeight = m_tileSize;
+	const int tileStride = tileWidth * tileHeight * 3;
+	const int tileCountX = divideRoundingUp(cropW, tileWidth);
+	const int tileCountY = divideRoundingUp(cropH, tileHeight);
+
+	// every node renders a horizontal band of the frame into output buffers allocated on that node
+	m_nodeTiles.resize(nodeCount);
+	m_nodeBuffers.reserve(nodeCount * 4);
+	for (int node = 0; node < nodeCount; ++node)
+	{
+		int firstRow = tileCountY * node / nodeCount;
+		int lastRow = tileCountY * (node + 1) / nodeCount;
+		int nodeTileCount = (lastRow - firstRow) * tileCountX;
+		int bufferNode = numaAware ? node : -1;
+
+		NodeBuffer &image = m_nodeBuffers.emplace_back(nodeTileCount * tileStride, bufferNode);
+		NodeBuffer &albedoImage = m_nodeBuffers.emplace_back(nodeTileCount * tileStride, bufferNode);
+		NodeBuffer &normalImage = m_nodeBuffers.emplace_back(nodeTileCount * tileStride, bufferNode);
+		NodeBuffer &depthImage = m_nodeBuffers.emplace_back(nodeTileCount * tileWidth * tileHeight, bufferNode);
+
+		for (int y = firstRow; y < lastRow; ++y)
+		{
+			for (int x = 0; x < tileCountX; ++x)
+			{
+				int index = (y - firstRow) * tileCountX + x;
+				tileData tile;
+				tile.x1 = crop.x1 + x * tileWidth;
+				tile.y1 = crop.y1 + y * tileHeight;
+				tile.x2 = std::min(crop.x1 + (x + 1) * tileWidth, crop.x2);
+				tile.y2 = std::min(crop.y1 + (y + 1) * tileHeight, crop.y2);
+				tile.tileOutput = image.GetData() + index * tileStride;
+				tile.albedoOutput = albedoImage.GetData() + index * tileStride;
+				tile.normalOutput = normalImage.GetData() + index * tileStride;
+				tile.depthOutput = depthImage.GetData() + index * tileWidth * tileHeight;
+				tile.cost = 0.0f;
+				m_nodeTiles[node].push_back(tile);
+			}
+		}
+	}
+	for (auto &t : m_nodeTiles)
+	{
+		m_tiles.insert(m_tiles.end(), t.begin(), t.end());
+	}
+
+	// a crop outside of the frame leaves nothing for the workers, the job is done right away
+	if (m_tiles.empty())
+	{
+		m_phase = Phase::Done;
+		m_finished = true;
+		Finish();
+	}
+}
+
+RenderJob::~RenderJob()
+{
+}
+
+const Scene &RenderJob::GetScene(int node)
+{
+	return m_replicas ? m_replicas->Get(node) : m_scene;
+}
+
+float RenderJob::GetProgress() const
+{
+	const PixelRect &crop = m_settings.crop;
+	return static_cast<float>(m_completedPixels) / static_cast<float>(std::max(1, (crop.x2 - crop.x1) * (crop.y2 - crop.y1)));
+}
+
+void RenderJob::Cancel()
+{
+	bool finish = false;
+	{
+		std::scoped_lock lock(m_lock);
+		if (m_finished) return;
+		m_cancelled = true;
+		// nothing in flight means no worker is going to come back and finish the job
+		if (m_inFlight == 0)
+		{
+			m_phase = Phase::Done;
+			m_finished = true;
+			finish = true;
+		}
+	}
+	if (finish)
+	{
+		Finish();
+	}
+}
+
+bool RenderJob::AcquireWork(int node, WorkItem *item)
+{
+	std::scoped_lock lock(m_lock);
+	if (m_finished || m_cancelled) return false;
+
+	if (m_phase == Phase::Estimate)
+	{
+		if (m_nextEstimate >= m_tiles.size()) return false;
+		item->phase = Phase::Estimate;
+		item->index = m_nextEstimate;
+		item->tile = m_tiles[m_nextEstimate++];
+		m_inFlight++;
+		return true;
+	}
+
+	if (m_phase == Phase::Train)
+	{
+		// every pass covers the whole frame, the next one has to wait for the field to be refined
+		if (m_nextTraining >= m_tiles.size()) return false;
+		item->phase = Phase::Train;
+		item->pass = m_trainingPass;
+		item->index = m_nextTraining;
+		item->tile = m_tiles[m_nextTraining++];
+		m_inFlight++;
+		return true;
+	}
+
+	if (m_phase == Phase::Render)
+	{
+		std::optional<tileData> tile = m_scheduler->Next(node);
+		if (!tile.has_value())
+		{
+			return false;
+		}
+		item->phase = Phase::Render;
+		item->tile = tile.value();
+		m_inFlight++;
+		return true;
+	}
+
+	if (m_phase == Phase::Gather)
+	{
+		if (m_nextGather >= m_tiles.size()) return false;
+		item->phase = Phase::Gather;
+		item->index = m_nextGather;
+		item->tile = m_tiles[m_nextGather++];
+		m_inFlight++;
+		return true;
+	}
+
+	if (m_phase == Phase::Denoise)
+	{
+		// like training, every pass needs the whole previous one
+		if (m_nextDenoise >= m_denoiser->GetTileCount()) return false;
+		item->phase = Phase::Denoise;
+		item->pass = m_denoisePass;
+		item->index = m_nextDenoise++;
+		m_inFlight++;
+		return true;
+	}
+
+	return false;
+}
+
+bool RenderJob::CompleteWork(const WorkItem &item)
+{
+	std::scoped_lock lock(m_lock);
+	m_inFlight--;
+
+	if (item.phase == Phase::Estimate && ++m_finishedEstimates == m_tiles.size())
+	{
+		// all costs are in, hand the tiles over to the scheduler
+		for (int node = 0, i = 0; node < static_cast<int>(m_nodeTiles.size()); ++node)
+		{
+			for (tileData &tile : m_nodeTiles[node])
+			{
+				tile.cost = m_tiles[i++].cost;
+			}
+		}
+		if (m_settings.guidingPasses > 0)
+		{
+			m_guiding = std::make_unique<GuidingField>();
+			m_phase = Phase::Train;
+		}
+		else
+		{
+			StartRender();
+		}
+	}
+	else if (item.phase == Phase::Train && ++m_finishedTraining == m_tiles.size())
+	{
+		// nothing is in flight, the field can change
+		m_guiding->Refine();
+		m_nextTraining = 0;
+		m_finishedTraining = 0;
+		if (++m_trainingPass == m_settings.guidingPasses)
+		{
+			StartRender();
+		}
+	}
+	else if (item.phase == Phase::Gather && ++m_finishedGather == m_tiles.size())
+	{
+		if (m_settings.denoise)
+		{
+			const PixelRect &crop = m_settings.crop;
+			m_denoised.resize(m_color.size());
+			m_denoiser = std::make_unique<Denoiser>(m_color.data(), *m_features, crop.x2 - crop.x1, crop.y2 - crop.y1, m_settings.denoiseSettings, m_denoised.data());
+			m_phase = Phase::Denoise;
+		}
+		else
+		{
+			m_phase = Phase::Done;
+		}
+	}
+	else if (item.phase == Phase::Denoise && ++m_finishedDenoise == m_denoiser->GetTileCount())
+	{
+		m_nextDenoise = 0;
+		m_finishedDenoise = 0;
+		if (++m_denoisePass == m_denoiser->GetPassCount())
+		{
+			m_phase = Phase::Done;
+		}
+	}
+
+	// the last tile may still be written to until nothing is in flight
+	if (m_phase == Phase::Render && m_scheduler->IsEmpty() && m_inFlight == 0 && !m_cancelled)
+	{
+		StartGather();
+	}
+
+	bool done = m_cancelled || m_phase == Phase::Done;
+	if (done && m_inFlight == 0 && !m_finished)
+	{
+		m_phase = Phase::Done;
+		m_finished = true;
+		return true;
+	}
+	return false;
+}
+
+void RenderJob::StartRender()
+{
+	m_scheduler = std::make_unique<TileScheduler>(std::move(m_nodeTiles), m_workerCount, m_tileSize, m_settings.tileOrder);
+	m_phase = Phase::Render;
+}
+
+void RenderJob::StartGather()
+{
+	const PixelRect &crop = m_settings.crop;
+	const int cropW = crop.x2 - crop.x1;
+	const int cropH = crop.y2 - crop.y1;
+	m_color.resize(cropW * cropH * 3);
+	m_features = std::make_unique<FeatureBuffers>(cropW, cropH);
+	m_phase = Phase::Gather;
+}
+
+void RenderJob::GatherTile(const tileData &tile)
+{
+	// untiles the color and feature buffers into scanline order for the denoiser
+	const PixelRect &crop = m_settings.crop;
+	const int cropW = crop.x2 - crop.x1;
+	for (int tileY = 0; tileY < tile.y2 - tile.y1; ++tileY)
+	{
+		for (int tileX = 0; tileX < tile.x2 - tile.x1; ++tileX)
+		{
+			int source = tileY * m_tileSize + tileX;
+			int target = (tile.y1 - crop.y1 + tileY) * cropW + tile.x1 - crop.x1 + tileX;
+			for (int c = 0; c < 3; ++c)
+			{
+				m_color[target * 3 + c] = tile.tileOutput[source * 3 + c];
+				m_features->albedo[target * 3 + c] = tile.albedoOutput[source * 3 + c];
+				m_features->normal[target * 3 + c] = tile.normalOutput[source * 3 + c];
+			}
+			m_features->depth[target] = tile.depthOutput[source];
+		}
+	}
+}
+
+void RenderJob::Finish()
+{
+	// nothing renders any more, the replicas can go once no other job holds them
+	m_replicas.reset();
+	if (m_cancelled)
+	{
+		m_promise.set_value(false);
+		return;
+	}
+
+	const int imageW = m_settings.width;
+	const int imageH = m_settings.height;
+	const PixelRect &crop = m_settings.crop;
+	const std::vector<float> &color = m_denoiser ? m_denoised : m_color;
+	// nothing was gathered for a crop outside of the frame
+	const int cropW = crop.x2 - crop.x1;
+	const int cropH = color.empty() ? 0 : crop.y2 - crop.y1;
+
+	m_framebuffer.assign(imageW * imageH * 3, 0.0f);
+	for (int y = 0; y < cropH; ++y)
+	{
+		std::copy(color.begin() + y * cropW * 3, color.begin() + (y + 1) * cropW * 3, m_framebuffer.begin() + ((crop.y1 + y) * imageW + crop.x1) * 3);
+	}
+
+	m_denoiser.reset();
+	m_features.reset();
+	std::vector<float>().swap(m_color);
+	std::vector<float>().swap(m_denoised);
+	m_promise.set_value(true);
+}
+
+bool RenderJob::MergeInto(const std::string &path) const
+{
+	if (m_framebuffer.empty()) return false;
+
+	const int imageW = m_settings.width;
+	const int imageH = m_settings.height;
+	std::error_code error;
+	if (!std::filesystem::exists(path, error))
+	{
+		return WritePFM(path, imageW, imageH, m_framebuffer.data());
+	}
+
+	int width;
+	int height;
+	std::vector<float> frame;
+	if (!ReadPFM(path, &width, &height, &frame)) return false;
+
+	const int previewScale = std::max(1, m_requestedSettings.previewScale);
+	int scale;
+	PixelRect crop;
+	if (width == imageW && height == imageH)
+	{
+		scale = 1;
+		crop = m_settings.crop;
+	}
+	else if (previewScale > 1 && width == m_requestedSettings.width && height == m_requestedSettings.height)
+	{
+		scale = previewScale;
+		// the requested window in frame pixels, the preview can cover a few more at its edges
+		crop = m_requestedSettings.crop.IsEmpty() ? PixelRect{ 0, 0, width, height } : m_requestedSettings.crop;
+		crop.x1 = std::clamp(crop.x1, 0, width);
+		crop.y1 = std::clamp(crop.y1, 0, height);
+		crop.x2 = std::clamp(crop.x2, crop.x1, width);
+		crop.y2 = std::clamp(crop.y2, crop.y1, height);
+	}
+	else
+	{
+		return false;
+	}
+
+	for (int y = crop.y1; y < crop.y2; ++y)
+	{
+		const int sourceY = std::min(y / scale, imageH - 1);
+		for (int x = crop.x1; x < crop.x2; ++x)
+		{
+			const int sourceX = std::min(x / scale, imageW - 1);
+			std::copy_n(m_framebuffer.begin() + (sourceY * imageW + sourceX) * 3, 3, frame.begin() + (y * width + x) * 3);
+		}
+	}
+	return WritePFM(path, width, height, frame.data());
+}
+
+Renderer::Renderer(int threadCount)
+	: m_topology(NumaTopology::Detect())
+{
+	const int nodeCount = m_topology.GetNodeCount();
+	if (threadCount <= 0)
+	{
+		threadCount = m_topology.GetCpuCount();
+	}
+
+	// one slot per allowed CPU, nodes interleaved so a smaller pool still spreads over all of them
+	struct Slot
+	{
+		int node;
+		int cpu;
+	};
+	std::vector<Slot> slots;
+	for (size_t round = 0; static_cast<int>(slots.size()) < m_topology.GetCpuCount(); ++round)
+	{
+		for (int node = 0; node < nodeCount; ++node)
+		{
+			const std::vector<int> &cpus = m_topology.GetCpus(node);
+			if (round < cpus.size()) slots.push_back({ node, cpus[round] });
+		}
+	}
+
+	for (int i = 0; i < threadCount; ++i) {
+		// threads past the CPU count share all CPUs of their node
+		const Slot slot = i < static_cast<int>(slots.size()) ? slots[i] : Slot{ i % nodeCount, -1 };
+		m_workers.emplace_back([this, slot]()
+		{
+			if (m_topology.IsNuma())
+			{
+				if (slot.cpu >= 0)
+				{
+					PinCurrentThread(slot.cpu);
+				}
+				else
+				{
+					PinCurrentThread(m_topology.GetCpus(slot.node));
+				}
+			}
+			WorkerMain(slot.node);
+		});
+	}
+}
+
+Renderer::~Renderer()
+{
+	{
+		std::scoped_lock lock(m_lock);
+		for (auto &job : m_jobs)
+		{
+			job->m_cancelled = true;
+		}
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto &worker : m_workers)
+	{
+		worker.join();
+	}
+	// whatever was still queued resolves as cancelled
+	for (auto &job : m_jobs)
+	{
+		job->Cancel();
+	}
+}
+
+std::shared_ptr<RenderJob> Renderer::Submit(const Scene &scene, const RenderSettings &settings, TileCallback onTile)
+{
+	std::shared_ptr<SceneReplicas> replicas;
+	if (m_topology.IsNuma() && settings.replicateScene)
+	{
+		std::scoped_lock lock(m_lock);
+		// replicas only the cache holds belong to finished jobs, their scene may be gone by now
+		for (auto entry = m_replicas.begin(); entry != m_replicas.end();)
+		{
+			if (entry->first != scene.GetId() && entry->second.use_count() == 1)
+			{
+				entry = m_replicas.erase(entry);
+			}
+			else
+			{
+				++entry;
+			}
+		}
+		std::shared_ptr<SceneReplicas> &cached = m_replicas[scene.GetId()];
+		if (!cached)
+		{
+			cached = std::make_shared<SceneReplicas>(scene, m_topology.GetNodeCount());
+		}
+		replicas = cached;
+	}
+
+	std::shared_ptr<RenderJob> job(new RenderJob(scene, settings, std::move(onTile), m_topology, GetThreadCount(), std::move(replicas)));
+	{
+		std::scoped_lock lock(m_lock);
+		m_jobs.push_back(job);
+	}
+	m_wake.notify_all();
+	return job;
+}
+
+bool Renderer::FindWork(int node, std::shared_ptr<RenderJob> *job, RenderJob::WorkItem *item)
+{
+	// finished and cancelled jobs drop out here, the caller's shared_ptr keeps them alive
+	m_jobs.erase(std::remove_if(m_jobs.begin(), m_jobs.end(), [](const std::shared_ptr<RenderJob> &j)
+	{
+		return j->m_cancelled || j->GetFuture().wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}), m_jobs.end());
+
+	// round robin over the jobs so concurrent jobs share the workers fairly
+	for (size_t i = 0; i < m_jobs.size(); ++i)
+	{
+		size_t index = (m_nextJob + i) % m_jobs.size();
+		if (m_jobs[index]->AcquireWork(node, item))
+		{
+			*job = m_jobs[index];
+			m_nextJob = index + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Renderer::WorkerMain(int node)
+{
+	std::random_device rd;
+	std::minstd_rand gen(rd());
+	// kept across tiles and jobs, shadow rays of the next tile are often blocked by the same occluders
+	OcclusionCache occlusion;
+
+	while (true)
+	{
+		std::shared_ptr<RenderJob> job;
+		RenderJob::WorkItem item;
+		{
+			std::unique_lock lock(m_lock);
+			m_wake.wait(lock, [&]() { return m_stop || FindWork(node, &job, &item); });
+			if (m_stop) return;
+		}
+
+		const RenderSettings &settings = job->m_settings;
+		const Scene &scene = job->GetScene(node);
+		Camera camera(settings.cameraOrigin, settings.fov, settings.width, settings.height);
+		occlusion.Bind(scene);
+		if (item.phase == RenderJob::Phase::Estimate)
+		{
+			job->m_tiles[item.index].cost = EstimateTileCost(&scene, camera, settings, item.tile, &occlusion, gen);
+		}
+		else if (item.phase == RenderJob::Phase::Train)
+		{
+			RenderSettings pass = settings;
+			pass.sampleCount = 1 << item.pass;
+			pass.sampleRegions.clear();
+			RenderTile(&scene, camera, pass, item.tile, job->m_tileSize, job->m_guiding.get(), true, &occlusion, gen, &job->m_cancelled);
+		}
+		else if (item.phase == RenderJob::Phase::Gather)
+		{
+			job->GatherTile(item.tile);
+		}
+		else if (item.phase == RenderJob::Phase::Denoise)
+		{
+			job->m_denoiser->RunTile(item.pass, static_cast<int>(item.index));
+		}
+		else if (RenderTile(&scene, camera, settings, item.tile, job->m_tileSize, job->m_guiding.get(), false, &occlusion, gen, &job->m_cancelled))
+		{
+			job->m_completedPixels += (item.tile.x2 - item.tile.x1) * (item.tile.y2 - item.tile.y1);
+			if (job->m_onTile)
+			{
+				job->m_onTile(*job, item.tile);
+			}
+		}
+
+		if (job->CompleteWork(item))
+		{
+			job->Finish();
+		}
+		// a finished estimate phase or job can make new work available to sleeping workers
+		m_wake.notify_all();
+	}
+}
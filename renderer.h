@@ -0,0 +1,244 @@
+#pragma once
+
+#include "math.h"
+#include "camera.h"
+#include "denoise.h"
+#include "numa.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Scene;
+class Primitive;
+class RenderJob;
+class GuidingField;
+
+// Pixel rectangle, x2 and y2 are exclusive.
+struct PixelRect
+{
+	int x1 = 0;
+	int y1 = 0;
+	int x2 = 0;
+	int y2 = 0;
+
+	bool IsEmpty() const { return x2 <= x1 || y2 <= y1; }
+	bool Contains(int x, int y) const { return x >= x1 && x < x2 && y >= y1 && y < y2; }
+};
+
+// Sample budget for the pixels inside rect, replacing RenderSettings::sampleCount there.
+struct SampleRegion
+{
+	PixelRect rect;
+	int sampleCount;
+};
+
+class RenderSettings
+{
+public:
+	int width = 1920;
+	int height = 1080;
+	int sampleCount = 16;
+	int bounceCount = 10;
+	vector3 cameraOrigin;
+	float fov = 37.8f;
+	bool denoise = true;
+	DenoiseSettings denoiseSettings;
+	TileOrder tileOrder = TileOrder::Hilbert;
+	bool replicateScene = true; // per NUMA node copies of the aggregate, ignored on single node machines
+	bool spectral = false; // hero wavelength sampling instead of RGB, slower to converge but needed for dispersion
+	// Ray cone spread in radians above which paths shade with SimpleBRDF and SDFs accept coarser hits.
+	// The default, infinity, keeps full quality on every bounce; about 0.5 switches after the first
+	// diffuse bounce.
+	float shadingLodSpread = std::numeric_limits<float>::infinity();
+	// Training passes of 1, 2, 4... samples per pixel that learn a GuidingField before the frame is
+	// rendered, 0 turns path guiding off. The training images are discarded.
+	int guidingPasses = 0;
+	// Integer downscale for previews, the frame renders at width / previewScale by height / previewScale
+	// with the same framing. crop and sampleRegions are given in full resolution pixels either way.
+	int previewScale = 1;
+	// Only the tiles inside the window are rendered and denoised, the framebuffer keeps the size of the
+	// frame and is black outside of it. Empty renders the whole frame.
+	PixelRect crop;
+	// Where regions overlap the last one wins.
+	std::vector<SampleRegion> sampleRegions;
+
+	int GetSampleCount(int x, int y) const;
+};
+
+// Called from a worker thread whenever a tile has finished. The tile's output pointers hold linear
+// radiance with a row stride of RenderJob::GetTileSize() pixels and stay valid for the job's lifetime.
+using TileCallback = std::function<void(const RenderJob &job, const tileData &tile)>;
+
+class Renderer;
+
+// Read-only copies of a scene's aggregate, one per NUMA node, shared by every job that renders the
+// scene. The first worker of a node that asks for its copy builds it, so the pages land on the node;
+// the node's other workers render from the scene itself until it is done.
+class SceneReplicas
+{
+public:
+	SceneReplicas(const Scene &scene, int nodeCount);
+	~SceneReplicas();
+
+	const Scene &Get(int node);
+
+private:
+	enum class State
+	{
+		Empty,
+		Building,
+		Ready,
+	};
+
+	struct Replica
+	{
+		std::atomic<State> state = State::Empty;
+		std::unique_ptr<Primitive> aggregate;
+		std::unique_ptr<Scene> scene;
+	};
+
+	const Scene &m_scene;
+	std::unique_ptr<Replica[]> m_replicas;
+};
+
+// Handle of a submitted frame. All methods are safe to call from any thread.
+class RenderJob
+{
+public:
+	~RenderJob();
+
+	// Stops handing out tiles, tiles already being rendered still finish. The future resolves to false.
+	void Cancel();
+	// Resolves to true once the framebuffer is complete, or false if the job was cancelled.
+	std::shared_future<bool> GetFuture() const { return m_future; }
+	bool Wait() const { return m_future.get(); }
+	bool IsCancelled() const { return m_cancelled; }
+	float GetProgress() const;
+
+	// As rendered: the size is the output size, crop and sample regions are in its pixels and the crop
+	// is never empty.
+	const RenderSettings &GetSettings() const { return m_settings; }
+	int GetTileSize() const { return m_tileSize; }
+	// Linear RGB, scanline ordered and denoised if requested. Only valid once the future resolved to true.
+	const std::vector<float> &GetFramebuffer() const { return m_framebuffer; }
+	// Copies the crop window of the framebuffer into the PFM at path, keeping the pixels around it.
+	// Previews merge into a frame of the full resolution too, each preview pixel covering previewScale
+	// squared frame pixels. A missing file is created from the framebuffer as it is. Returns false and
+	// leaves the file alone if it cannot be read or its size matches neither resolution.
+	bool MergeInto(const std::string &path) const;
+
+private:
+	friend class Renderer;
+
+	enum class Phase
+	{
+		Estimate,
+		Train,
+		Render,
+		Gather, // untiles the crop for the denoiser
+		Denoise,
+		Done,
+	};
+
+	struct WorkItem
+	{
+		Phase phase;
+		int pass; // training or denoise pass
+		size_t index; // into m_tiles, or the denoiser's tile
+		tileData tile;
+	};
+
+	RenderJob(const Scene &scene, const RenderSettings &settings, TileCallback onTile, const NumaTopology &topology, int workerCount,
+		std::shared_ptr<SceneReplicas> replicas);
+
+	bool AcquireWork(int node, WorkItem *item);
+	// Returns true if the job is finished after this item and needs Finish() to be called.
+	bool CompleteWork(const WorkItem &item);
+	void StartRender();
+	void StartGather();
+	void GatherTile(const tileData &tile);
+	void Finish();
+	const Scene &GetScene(int node);
+
+	const Scene &m_scene;
+	RenderSettings m_settings;
+	RenderSettings m_requestedSettings; // as submitted, in full resolution pixels
+	TileCallback m_onTile;
+	int m_workerCount;
+	int m_tileSize;
+
+	std::shared_ptr<SceneReplicas> m_replicas; // null when every node renders the scene itself
+	std::vector<NodeBuffer> m_nodeBuffers;
+	std::vector<std::vector<tileData>> m_nodeTiles;
+	std::vector<tileData> m_tiles;
+	std::unique_ptr<TileScheduler> m_scheduler;
+	std::unique_ptr<GuidingField> m_guiding;
+	std::vector<float> m_color; // the crop in scanline order
+	std::unique_ptr<FeatureBuffers> m_features;
+	std::vector<float> m_denoised;
+	std::unique_ptr<Denoiser> m_denoiser;
+
+	std::mutex m_lock;
+	Phase m_phase = Phase::Estimate;
+	size_t m_nextEstimate = 0;
+	size_t m_finishedEstimates = 0;
+	int m_trainingPass = 0;
+	size_t m_nextTraining = 0;
+	size_t m_finishedTraining = 0;
+	size_t m_nextGather = 0;
+	size_t m_finishedGather = 0;
+	int m_denoisePass = 0;
+	int m_nextDenoise = 0;
+	int m_finishedDenoise = 0;
+	int m_inFlight = 0;
+	bool m_finished = false;
+	std::atomic<bool> m_cancelled = false;
+	std::atomic<int> m_completedPixels = 0;
+
+	std::vector<float> m_framebuffer;
+	std::promise<bool> m_promise;
+	std::shared_future<bool> m_future;
+};
+
+// Owns a pool of (NUMA pinned) worker threads shared by every job submitted to it. Workers take
+// tiles from the active jobs in turn, so concurrent jobs progress side by side.
+class Renderer
+{
+public:
+	// threadCount 0 uses one worker per CPU the process may run on.
+	Renderer(int threadCount = 0);
+	~Renderer();
+	Renderer(const Renderer &) = delete;
+	Renderer &operator=(const Renderer &) = delete;
+
+	// The scene must outlive the job and must not change once submitted. On NUMA machines its
+	// replicas are kept for later jobs of the same scene, see SceneReplicas.
+	std::shared_ptr<RenderJob> Submit(const Scene &scene, const RenderSettings &settings, TileCallback onTile = TileCallback());
+
+	int GetThreadCount() const { return static_cast<int>(m_workers.size()); }
+
+private:
+	void WorkerMain(int node);
+	bool FindWork(int node, std::shared_ptr<RenderJob> *job, RenderJob::WorkItem *item);
+
+	NumaTopology m_topology;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::vector<std::shared_ptr<RenderJob>> m_jobs;
+	size_t m_nextJob = 0;
+	// by Scene::GetId, dropped once no job holds them and another scene is submitted
+	std::map<uint64_t, std::shared_ptr<SceneReplicas>> m_replicas;
+	bool m_stop = false;
+};
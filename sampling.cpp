@@ -0,0 +1,16 @@
+#include "sampling.h"
+
+float radicalInverse_VdC(uint32_t bits) {
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	return float(bits) * 2.3283064365386963e-10; // / 0x100000000
+}
+
+void hammersley(uint32_t i, uint32_t N, uint32_t offset, float *a, float *b)
+{
+	*a = static_cast<float>(i) / static_cast<float>(N);
+	*b = radicalInverse_VdC(i + offset);
+}
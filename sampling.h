@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+float radicalInverse_VdC(uint32_t bits);
+void hammersley(uint32_t i, uint32_t N, uint32_t offset, float *a, float *b);
@@ -1,4 +1,29 @@
 #include "scene.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "sphere.h"
+#include "plane.h"
+
+#include <atomic>
+
+Scene::Scene(std::unique_ptr<Primitive> &&aggregate, std::vector<std::unique_ptr<Light>> &&lights, std::vector<std::unique_ptr<Material>> &&materials,
+	std::vector<std::unique_ptr<Medium>> &&media, std::unique_ptr<EnvironmentMap> &&environment)
+	: m_ownedAggregate(std::move(aggregate))
+	, m_ownedLights(std::move(lights))
+	, m_ownedMaterials(std::move(materials))
+	, m_ownedMedia(std::move(media))
+	, m_ownedEnvironment(std::move(environment))
+	, m_aggregate(*m_ownedAggregate)
+	, m_lights(m_ownedLights)
+	, m_environment(m_ownedEnvironment.get())
+{
+}
+
+uint64_t Scene::NextId()
+{
+	static std::atomic<uint64_t> nextId = 0;
+	return nextId++;
+}
 
 Material *Scene::GetSkyMaterial() const
 {
@@ -8,4 +33,85 @@ Material *Scene::GetSkyMaterial() const
 bool Scene::Intersect(const Ray &ray, Hit *hit) const
 {
 	return m_aggregate.Intersect(ray, hit);
-}
\ No newline at end of file
+}
+
+bool Scene::Occluded(const Ray &ray, const Primitive **lastOccluder) const
+{
+	if (lastOccluder && *lastOccluder && (*lastOccluder)->Occluded(ray, nullptr)) return true;
+	return m_aggregate.Occluded(ray, lastOccluder);
+}
+
+float Scene::GetBytesPerPrimitive() const
+{
+	size_t count = GetPrimitiveCount();
+	return count ? static_cast<float>(GetMemoryBytes()) / static_cast<float>(count) : 0.0f;
+}
+
+Material *SceneBuilder::AddMaterial(vector3 color, float roughness, float metalness)
+{
+	m_materials.push_back(std::make_unique<Material>(color, roughness, metalness));
+	return m_materials.back().get();
+}
+
+const Medium *SceneBuilder::AddMedium(std::unique_ptr<Medium> &&medium)
+{
+	m_media.push_back(std::move(medium));
+	return m_media.back().get();
+}
+
+void SceneBuilder::AddShape(std::unique_ptr<Shape> &&shape, Material *material, const Medium *interior)
+{
+	m_hasInteriors |= interior != nullptr || material == nullptr;
+	m_primitives.push_back(std::make_unique<GeometricPrimitive>(std::move(shape), material, interior));
+}
+
+void SceneBuilder::AddSphere(vector3 center, float radius, Material *material, const Medium *interior)
+{
+	AddShape(std::make_unique<Sphere>(center, radius), material, interior);
+}
+
+void SceneBuilder::AddPlane(vector3 normal, float d, Material *material)
+{
+	AddShape(std::make_unique<Plane>(normal, d), material);
+}
+
+void SceneBuilder::AddMesh(const std::vector<vector3> &positions, const std::vector<vector3> &normals, const std::vector<uint32_t> &indices,
+	Material *material, bool compress)
+{
+	AddShape(std::make_unique<TriangleMesh>(positions, normals, indices, compress), material);
+}
+
+void SceneBuilder::AddLight(vector3 pos, vector3 color, float strength)
+{
+	m_lights.push_back(std::make_unique<Light>(pos, color, strength));
+}
+
+void SceneBuilder::SetSky(vector3 color)
+{
+	m_sky = AddMaterial(color, 1.0f, 0.0f);
+}
+
+std::unique_ptr<Scene> SceneBuilder::Build()
+{
+	std::unique_ptr<Primitive> aggregate;
+	if (m_aggregateType == AggregateType::BVH)
+	{
+		aggregate = std::make_unique<BVHPrimitives>(std::move(m_primitives));
+	}
+	else
+	{
+		aggregate = std::make_unique<LoosePrimitives>(std::move(m_primitives));
+	}
+	auto scene = std::make_unique<Scene>(std::move(aggregate), std::move(m_lights), std::move(m_materials), std::move(m_media), std::move(m_environment));
+	scene->m_skyMaterial = m_sky;
+	scene->m_medium = m_medium;
+	scene->m_hasInteriors = m_hasInteriors;
+	m_primitives.clear();
+	m_lights.clear();
+	m_materials.clear();
+	m_media.clear();
+	m_sky = nullptr;
+	m_medium = nullptr;
+	m_hasInteriors = false;
+	return scene;
+}
@@ -2,12 +2,15 @@
 
 #include "primitive.h"
 #include "light.h"
+#include "material.h"
+#include "envmap.h"
+#include "medium.h"
 
+#include <cstdint>
+#include <limits>
 #include <vector>
 #include <memory>
 
-class Material;
-
 class Scene
 {
 public:
@@ -15,9 +18,101 @@ public:
 		: m_aggregate(aggregate)
 		, m_lights(lights)
 		{}
+	// Scene that owns its geometry, lights and materials, see SceneBuilder.
+	Scene(std::unique_ptr<Primitive> &&aggregate, std::vector<std::unique_ptr<Light>> &&lights, std::vector<std::unique_ptr<Material>> &&materials,
+		std::vector<std::unique_ptr<Medium>> &&media, std::unique_ptr<EnvironmentMap> &&environment = nullptr);
 	Material *GetSkyMaterial() const;
 	bool Intersect(const Ray &ray, Hit *hit) const;
+	// Any hit closer than ray.tMax, for shadow rays. lastOccluder, if given, is tested before the
+	// aggregate and replaced by the primitive that blocked the ray, see OcclusionCache.
+	bool Occluded(const Ray &ray, const Primitive **lastOccluder = nullptr) const;
+
+	// Memory held by the geometry and acceleration structures, triangles of meshes count as primitives.
+	size_t GetMemoryBytes() const { return m_aggregate.GetMemoryBytes(); }
+	size_t GetPrimitiveCount() const { return m_aggregate.GetPrimitiveCount(); }
+	float GetBytesPerPrimitive() const;
+	// False when rays can neither scatter in a medium nor cross medium boundaries, shadow rays take a shortcut then.
+	bool HasMedia() const { return m_medium || m_hasInteriors; }
+	// Never reused within the process, unlike the address of a destroyed scene.
+	uint64_t GetId() const { return m_id; }
+
+private:
+	// declared ahead of the references below so they are constructed first
+	std::unique_ptr<Primitive> m_ownedAggregate;
+	std::vector<std::unique_ptr<Light>> m_ownedLights;
+	std::vector<std::unique_ptr<Material>> m_ownedMaterials;
+	std::vector<std::unique_ptr<Medium>> m_ownedMedia;
+	std::unique_ptr<EnvironmentMap> m_ownedEnvironment;
+	static uint64_t NextId();
+	const uint64_t m_id = NextId();
+
+public:
 	Primitive &m_aggregate;
 	std::vector<std::unique_ptr<Light>> &m_lights;
-	Material *m_skyMaterial;
+	Material *m_skyMaterial = nullptr;
+	const Medium *m_medium = nullptr; // surrounds the camera and everything outside of primitive interiors
+	const EnvironmentMap *m_environment = nullptr; // replaces the sky material and is sampled as a light
+	bool m_hasInteriors = false;
+};
+
+// The primitive that last blocked a shadow ray, per light and for the environment. Neighbouring
+// shadow rays towards the same light are mostly blocked by the same primitive. Every worker keeps
+// one across its tiles and binds it to the scene of each; binding another scene forgets the occluders.
+class OcclusionCache
+{
+public:
+	void Bind(const Scene &scene)
+	{
+		if (scene.GetId() == m_sceneId) return;
+		m_sceneId = scene.GetId();
+		m_occluders.assign(scene.m_lights.size() + 1, nullptr);
+	}
+	const Primitive **GetLight(size_t light) { return &m_occluders[light]; }
+	const Primitive **GetEnvironment() { return &m_occluders.back(); }
+	size_t GetSlotCount() const { return m_occluders.size(); }
+
+private:
+	uint64_t m_sceneId = std::numeric_limits<uint64_t>::max();
+	std::vector<const Primitive *> m_occluders;
+};
+
+enum class AggregateType
+{
+	List, // every primitive is tested against every ray
+	BVH, // compressed four-wide BVH, see BVHPrimitives
+};
+
+// Collects geometry, materials and lights and turns them into a self-contained Scene.
+class SceneBuilder
+{
+public:
+	void SetAggregate(AggregateType type) { m_aggregateType = type; }
+	Material *AddMaterial(vector3 color, float roughness, float metalness);
+	// The builder owns the medium, use the result with SetMedium or as the interior of closed shapes.
+	const Medium *AddMedium(std::unique_ptr<Medium> &&medium);
+	void SetMedium(const Medium *medium) { m_medium = medium; }
+	// material may be null for a pure medium boundary, see GeometricPrimitive.
+	void AddShape(std::unique_ptr<Shape> &&shape, Material *material, const Medium *interior = nullptr);
+	void AddSphere(vector3 center, float radius, Material *material, const Medium *interior = nullptr);
+	void AddPlane(vector3 normal, float d, Material *material);
+	// See TriangleMesh, normals may be empty.
+	void AddMesh(const std::vector<vector3> &positions, const std::vector<vector3> &normals, const std::vector<uint32_t> &indices,
+		Material *material, bool compress = true);
+	void AddLight(vector3 pos, vector3 color, float strength);
+	void SetSky(vector3 color);
+	// Lights the scene from every direction, escaped rays see it instead of the sky color.
+	void SetEnvironment(std::unique_ptr<EnvironmentMap> &&environment) { m_environment = std::move(environment); }
+
+	std::unique_ptr<Scene> Build();
+
+private:
+	std::vector<std::unique_ptr<Primitive>> m_primitives;
+	std::vector<std::unique_ptr<Light>> m_lights;
+	std::vector<std::unique_ptr<Material>> m_materials;
+	std::vector<std::unique_ptr<Medium>> m_media;
+	std::unique_ptr<EnvironmentMap> m_environment;
+	Material *m_sky = nullptr;
+	const Medium *m_medium = nullptr;
+	bool m_hasInteriors = false;
+	AggregateType m_aggregateType = AggregateType::List;
 };
@@ -0,0 +1,151 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+static uint32_t mortonKey(uint32_t x, uint32_t y)
+{
+	auto spread = [](uint32_t v)
+	{
+		v &= 0xffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1);
+}
+
+// distance along a Hilbert curve covering an n x n grid, n a power of two
+static uint32_t hilbertKey(uint32_t n, uint32_t x, uint32_t y)
+{
+	uint32_t d = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2)
+	{
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+TileScheduler::TileScheduler(std::vector<std::vector<tileData>> &&nodeTiles, int workerCount, int stride, TileOrder order)
+	: m_workerCount(workerCount)
+	, m_stride(stride)
+{
+	for (auto &tiles : nodeTiles)
+	{
+		if (order != TileOrder::RowMajor && !tiles.empty())
+		{
+			int tileW = tiles.front().x2 - tiles.front().x1;
+			int tileH = tiles.front().y2 - tiles.front().y1;
+			int maxX = 0;
+			int maxY = 0;
+			for (auto &tile : tiles)
+			{
+				maxX = std::max(maxX, tile.x1 / tileW);
+				maxY = std::max(maxY, tile.y1 / tileH);
+			}
+			uint32_t n = 1;
+			while (n <= static_cast<uint32_t>(std::max(maxX, maxY))) n *= 2;
+
+			auto key = [&](const tileData &tile)
+			{
+				uint32_t x = tile.x1 / tileW;
+				uint32_t y = tile.y1 / tileH;
+				return order == TileOrder::Morton ? mortonKey(x, y) : hilbertKey(n, x, y);
+			};
+			std::stable_sort(tiles.begin(), tiles.end(), [&](const tileData &a, const tileData &b) { return key(a) < key(b); });
+		}
+
+		for (auto &tile : tiles)
+		{
+			m_remainingCost += tile.cost;
+		}
+		m_remainingTiles += tiles.size();
+		m_queues.emplace_back(tiles.begin(), tiles.end());
+	}
+}
+
+bool TileScheduler::ShouldSplit(const tileData &tile) const
+{
+	// only worth it in the tail of the frame, earlier the other queued tiles keep everyone busy
+	if (m_remainingTiles > static_cast<size_t>(m_workerCount) * 2) return false;
+	if (tile.x2 - tile.x1 < minTileSize * 2 || tile.y2 - tile.y1 < minTileSize * 2) return false;
+
+	double averageCost = (m_remainingCost + tile.cost) / static_cast<double>(m_remainingTiles + 1);
+	return tile.cost > averageCost * splitThreshold;
+}
+
+std::optional<tileData> TileScheduler::Next(int node)
+{
+	std::scoped_lock lock(m_lock);
+	const int nodeCount = static_cast<int>(m_queues.size());
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		std::deque<tileData> &queue = m_queues[(node + i) % nodeCount];
+		if (queue.empty()) continue;
+
+		tileData tile = queue.front();
+		queue.pop_front();
+		m_remainingTiles--;
+		m_remainingCost -= tile.cost;
+
+		while (ShouldSplit(tile))
+		{
+			int midX = (tile.x1 + tile.x2) / 2;
+			int midY = (tile.y1 + tile.y2) / 2;
+			tileData quadrants[4] = { tile, tile, tile, tile };
+			quadrants[0].x2 = midX; quadrants[0].y2 = midY;
+			quadrants[1].x1 = midX; quadrants[1].y2 = midY;
+			quadrants[2].x2 = midX; quadrants[2].y1 = midY;
+			quadrants[3].x1 = midX; quadrants[3].y1 = midY;
+			for (tileData &quadrant : quadrants)
+			{
+				int offset = (quadrant.y1 - tile.y1) * m_stride + (quadrant.x1 - tile.x1);
+				quadrant.tileOutput += offset * 3;
+				quadrant.albedoOutput += offset * 3;
+				quadrant.normalOutput += offset * 3;
+				quadrant.depthOutput += offset;
+				quadrant.cost = tile.cost * 0.25f;
+			}
+
+			// the siblings go to the front of the queue so they are picked up next, keeping the curve order
+			for (int q = 3; q > 0; --q)
+			{
+				queue.push_front(quadrants[q]);
+				m_remainingTiles++;
+				m_remainingCost += quadrants[q].cost;
+			}
+			tile = quadrants[0];
+		}
+		return tile;
+	}
+	return std::nullopt;
+}
+
+bool TileScheduler::IsEmpty()
+{
+	std::scoped_lock lock(m_lock);
+	return m_remainingTiles == 0;
+}
+
+int TileScheduler::ChooseTileSize(int imageW, int imageH, int workerCount)
+{
+	const int tilesPerWorker = 16;
+	int target = static_cast<int>(std::sqrt(static_cast<double>(imageW) * imageH / (std::max(1, workerCount) * tilesPerWorker)));
+	int size = 8;
+	while (size * 2 <= target && size < 64) size *= 2;
+	return size;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Output pointers address the top-left pixel of the tile inside a buffer with a fixed row stride,
+// so a sub-tile shares its parent's buffers and only offsets the pointers.
+struct tileData
+{
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+	float *tileOutput;
+	float *albedoOutput;
+	float *normalOutput;
+	float *depthOutput;
+	float cost; // estimated render time, any unit as long as it is the same for every tile
+};
+
+enum class TileOrder
+{
+	RowMajor,
+	Morton,
+	Hilbert,
+};
+
+// Hands out tiles to render workers. Every NUMA node has its own queue walked in space-filling-curve
+// order, workers take from their own node first and steal from the others. Once the frame is nearly
+// done, tiles that are predicted to be much more expensive than average are split into quadrants so
+// that idle workers can pick up the pieces instead of waiting on a single long tile.
+class TileScheduler
+{
+public:
+	TileScheduler(std::vector<std::vector<tileData>> &&nodeTiles, int workerCount, int stride, TileOrder order);
+
+	std::optional<tileData> Next(int node);
+	// Once empty the scheduler stays empty, tiles are only ever split when handed out.
+	bool IsEmpty();
+
+	// Square tile size giving every worker enough tiles to balance, a power of two between 8 and 64.
+	static int ChooseTileSize(int imageW, int imageH, int workerCount);
+
+	int minTileSize = 8;
+	float splitThreshold = 1.5f; // relative to the average cost of the tiles left in the frame
+
+private:
+	bool ShouldSplit(const tileData &tile) const;
+
+	std::mutex m_lock;
+	std::vector<std::deque<tileData>> m_queues;
+	int m_workerCount;
+	int m_stride;
+	size_t m_remainingTiles = 0;
+	double m_remainingCost = 0.0;
+};
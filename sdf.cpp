@@ -0,0 +1,504 @@
+#include "sdf.h"
+#include "hit.h"
+
+#include <algorithm>
+#include <cmath>
+
+vfloat4 SdfNode::Distance4(const vector3x4 &p) const
+{
+	float x[4];
+	float y[4];
+	float z[4];
+	p.x.Store(x);
+	p.y.Store(y);
+	p.z.Store(z);
+	return vfloat4(Distance(vector3(x[0], y[0], z[0])), Distance(vector3(x[1], y[1], z[1])),
+		Distance(vector3(x[2], y[2], z[2])), Distance(vector3(x[3], y[3], z[3])));
+}
+
+static vfloat4 length(const vfloat4 &x, const vfloat4 &y, const vfloat4 &z)
+{
+	return sqrt(x * x + y * y + z * z);
+}
+
+float SdfSphere::Distance(const vector3 &p) const
+{
+	return (p - m_center).length() - m_radius;
+}
+
+vfloat4 SdfSphere::Distance4(const vector3x4 &p) const
+{
+	return length(p.x - m_center.x, p.y - m_center.y, p.z - m_center.z) - m_radius;
+}
+
+AABB SdfSphere::GetBounds() const
+{
+	return AABB(m_center - vector3(m_radius), m_center + vector3(m_radius));
+}
+
+float SdfBox::Distance(const vector3 &p) const
+{
+	vector3 q = p - m_center;
+	q = vector3(std::abs(q.x), std::abs(q.y), std::abs(q.z)) - m_halfExtent + vector3(m_rounding);
+	vector3 outside(std::max(q.x, 0.0f), std::max(q.y, 0.0f), std::max(q.z, 0.0f));
+	float inside = std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+	return outside.length() + inside - m_rounding;
+}
+
+vfloat4 SdfBox::Distance4(const vector3x4 &p) const
+{
+	const vfloat4 zero(0.0f);
+	vfloat4 qx = abs(p.x - m_center.x) - (m_halfExtent.x - m_rounding);
+	vfloat4 qy = abs(p.y - m_center.y) - (m_halfExtent.y - m_rounding);
+	vfloat4 qz = abs(p.z - m_center.z) - (m_halfExtent.z - m_rounding);
+	vfloat4 inside = min(max(qx, max(qy, qz)), zero);
+	return length(max(qx, zero), max(qy, zero), max(qz, zero)) + inside - m_rounding;
+}
+
+AABB SdfBox::GetBounds() const
+{
+	return AABB(m_center - m_halfExtent, m_center + m_halfExtent);
+}
+
+float SdfTorus::Distance(const vector3 &p) const
+{
+	vector3 q = p - m_center;
+	float ring = std::sqrt(q.x * q.x + q.z * q.z) - m_majorRadius;
+	return std::sqrt(ring * ring + q.y * q.y) - m_minorRadius;
+}
+
+vfloat4 SdfTorus::Distance4(const vector3x4 &p) const
+{
+	vfloat4 qx = p.x - m_center.x;
+	vfloat4 qy = p.y - m_center.y;
+	vfloat4 qz = p.z - m_center.z;
+	vfloat4 ring = sqrt(qx * qx + qz * qz) - m_majorRadius;
+	return sqrt(ring * ring + qy * qy) - m_minorRadius;
+}
+
+AABB SdfTorus::GetBounds() const
+{
+	float r = m_majorRadius + m_minorRadius;
+	return AABB(m_center - vector3(r, m_minorRadius, r), m_center + vector3(r, m_minorRadius, r));
+}
+
+float SdfUnion::Distance(const vector3 &p) const
+{
+	return std::min(m_a->Distance(p), m_b->Distance(p));
+}
+
+vfloat4 SdfUnion::Distance4(const vector3x4 &p) const
+{
+	return min(m_a->Distance4(p), m_b->Distance4(p));
+}
+
+AABB SdfUnion::GetBounds() const
+{
+	return Union(m_a->GetBounds(), m_b->GetBounds());
+}
+
+std::unique_ptr<SdfNode> SdfUnion::Clone() const
+{
+	return std::make_unique<SdfUnion>(m_a->Clone(), m_b->Clone());
+}
+
+float SdfSmoothUnion::Distance(const vector3 &p) const
+{
+	float a = m_a->Distance(p);
+	float b = m_b->Distance(p);
+	float h = clamp(0.5f + 0.5f * (b - a) / m_k, 0.0f, 1.0f);
+	return b + (a - b) * h - m_k * h * (1.0f - h);
+}
+
+vfloat4 SdfSmoothUnion::Distance4(const vector3x4 &p) const
+{
+	vfloat4 a = m_a->Distance4(p);
+	vfloat4 b = m_b->Distance4(p);
+	vfloat4 h = clamp(vfloat4(0.5f) + vfloat4(0.5f / m_k) * (b - a), vfloat4(0.0f), vfloat4(1.0f));
+	return b + (a - b) * h - vfloat4(m_k) * h * (vfloat4(1.0f) - h);
+}
+
+AABB SdfSmoothUnion::GetBounds() const
+{
+	// the blend pulls the surface out by at most k / 4 where the two shapes meet
+	return Union(m_a->GetBounds(), m_b->GetBounds()).Grow(0.25f * m_k);
+}
+
+std::unique_ptr<SdfNode> SdfSmoothUnion::Clone() const
+{
+	return std::make_unique<SdfSmoothUnion>(m_a->Clone(), m_b->Clone(), m_k);
+}
+
+float SdfSubtract::Distance(const vector3 &p) const
+{
+	return std::max(m_a->Distance(p), -m_b->Distance(p));
+}
+
+vfloat4 SdfSubtract::Distance4(const vector3x4 &p) const
+{
+	return max(m_a->Distance4(p), -m_b->Distance4(p));
+}
+
+AABB SdfSubtract::GetBounds() const
+{
+	return m_a->GetBounds();
+}
+
+std::unique_ptr<SdfNode> SdfSubtract::Clone() const
+{
+	return std::make_unique<SdfSubtract>(m_a->Clone(), m_b->Clone());
+}
+
+// worst case gradient length of Noise: corner values differ by up to 2 and the smoothstep slope peaks at 1.5
+static const float noiseMaxSlope = 3.0f * 1.4142136f;
+
+SdfTerrain::SdfTerrain(vector3 center, float halfSize, float amplitude, float frequency, int octaves, uint32_t seed)
+	: m_center(center)
+	, m_halfSize(halfSize)
+	, m_amplitude(amplitude)
+	, m_frequency(frequency)
+	, m_octaves(octaves)
+	, m_seed(seed)
+{
+	// every octave halves the amplitude and doubles the frequency, so each adds the same slope
+	float maxSlope = 0.0f;
+	m_maxHeight = 0.0f;
+	float a = amplitude;
+	for (int i = 0; i < octaves; ++i)
+	{
+		m_maxHeight += a;
+		maxSlope += a * frequency * static_cast<float>(1 << i) * noiseMaxSlope;
+		a *= 0.5f;
+	}
+	m_distanceScale = 1.0f / std::sqrt(1.0f + maxSlope * maxSlope);
+}
+
+float SdfTerrain::Noise(float x, float z) const
+{
+	auto hash = [this](int32_t ix, int32_t iz)
+	{
+		uint32_t h = static_cast<uint32_t>(ix) * 0x8da6b343u ^ static_cast<uint32_t>(iz) * 0xd8163841u ^ m_seed * 0xcb1ab31fu;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		h ^= h >> 15;
+		return static_cast<float>(h & 0xffffff) * (2.0f / 16777215.0f) - 1.0f;
+	};
+
+	float fx = std::floor(x);
+	float fz = std::floor(z);
+	int32_t ix = static_cast<int32_t>(fx);
+	int32_t iz = static_cast<int32_t>(fz);
+	float tx = x - fx;
+	float tz = z - fz;
+	tx = tx * tx * (3.0f - 2.0f * tx);
+	tz = tz * tz * (3.0f - 2.0f * tz);
+	return lerp(lerp(hash(ix, iz), hash(ix + 1, iz), tx), lerp(hash(ix, iz + 1), hash(ix + 1, iz + 1), tx), tz);
+}
+
+float SdfTerrain::Height(float x, float z) const
+{
+	float height = m_center.y;
+	float a = m_amplitude;
+	float f = m_frequency;
+	for (int i = 0; i < m_octaves; ++i)
+	{
+		// offset the octaves so their lattices do not line up
+		height += a * Noise(x * f + 17.3f * i, z * f - 31.7f * i);
+		a *= 0.5f;
+		f *= 2.0f;
+	}
+	return height;
+}
+
+float SdfTerrain::Distance(const vector3 &p) const
+{
+	// a closed slab: the height field on top, cut to the patch and to a floor below the lowest valley
+	float surface = (p.y - Height(p.x, p.z)) * m_distanceScale;
+	float side = std::max(std::abs(p.x - m_center.x), std::abs(p.z - m_center.z)) - m_halfSize;
+	float floor = (m_center.y - 2.0f * m_maxHeight) - p.y;
+	return std::max(surface, std::max(side, floor));
+}
+
+AABB SdfTerrain::GetBounds() const
+{
+	return AABB(vector3(m_center.x - m_halfSize, m_center.y - 2.0f * m_maxHeight, m_center.z - m_halfSize),
+		vector3(m_center.x + m_halfSize, m_center.y + m_maxHeight, m_center.z + m_halfSize));
+}
+
+SdfShape::SdfShape(std::unique_ptr<SdfNode> &&root, float epsilon)
+	: m_root(std::move(root))
+	, m_epsilon(epsilon)
+{
+	// the padding keeps rays that start on the surface inside the marching interval
+	m_bounds = m_root->GetBounds().Grow(2.0f * epsilon);
+}
+
+SdfShape::SdfShape(const SdfShape &other)
+	: m_root(other.m_root->Clone())
+	, m_bounds(other.m_bounds)
+	, m_epsilon(other.m_epsilon)
+	, m_brickResolution(other.m_brickResolution)
+	, m_brickSize(other.m_brickSize)
+	, m_brickIndex(other.m_brickIndex)
+	, m_brickSamples(other.m_brickSamples)
+	, m_brickMargins(other.m_brickMargins)
+{
+	std::copy(other.m_gridSize, other.m_gridSize + 3, m_gridSize);
+}
+
+vector3 SdfShape::Gradient(const vector3 &p, float h) const
+{
+	vector3x4 q(vfloat4(p.x) + vfloat4(h, -h, -h, h), vfloat4(p.y) + vfloat4(-h, -h, h, h), vfloat4(p.z) + vfloat4(-h, h, -h, h));
+	float d[4];
+	m_root->Distance4(q).Store(d);
+	return vector3(d[0] - d[1] - d[2] + d[3], -d[0] - d[1] + d[2] + d[3], -d[0] + d[1] - d[2] + d[3]);
+}
+
+void SdfShape::BuildBrickCache(int resolution, int brickResolution)
+{
+	if (!m_bounds.IsFinite()) return;
+
+	const vector3 extent = m_bounds.Extent();
+	m_brickSize = std::max(extent.x, std::max(extent.y, extent.z)) / static_cast<float>(resolution);
+	m_gridSize[0] = std::max(1, static_cast<int>(std::ceil(extent.x / m_brickSize)));
+	m_gridSize[1] = std::max(1, static_cast<int>(std::ceil(extent.y / m_brickSize)));
+	m_gridSize[2] = std::max(1, static_cast<int>(std::ceil(extent.z / m_brickSize)));
+	m_brickResolution = brickResolution;
+	m_brickIndex.assign(m_gridSize[0] * m_gridSize[1] * m_gridSize[2], -1);
+	m_brickSamples.clear();
+	m_brickMargins.clear();
+
+	const int samplesPerAxis = brickResolution + 1;
+	const int samplesPerBrick = samplesPerAxis * samplesPerAxis * samplesPerAxis;
+	const float voxelSize = m_brickSize / static_cast<float>(brickResolution);
+	const float halfDiagonal = 0.5f * std::sqrt(3.0f) * m_brickSize;
+
+	std::vector<vector3> positions(samplesPerBrick);
+	for (int z = 0; z < m_gridSize[2]; ++z)
+	{
+		for (int y = 0; y < m_gridSize[1]; ++y)
+		{
+			for (int x = 0; x < m_gridSize[0]; ++x)
+			{
+				const vector3 corner = m_bounds.min + vector3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * m_brickSize;
+				// the field never overestimates, so a center further away than the half diagonal proves the brick empty
+				if (std::abs(m_root->Distance(corner + vector3(0.5f * m_brickSize))) > halfDiagonal) continue;
+
+				m_brickIndex[(z * m_gridSize[1] + y) * m_gridSize[0] + x] = static_cast<int32_t>(m_brickSamples.size() / samplesPerBrick);
+				for (int i = 0; i < samplesPerBrick; ++i)
+				{
+					int sx = i % samplesPerAxis;
+					int sy = (i / samplesPerAxis) % samplesPerAxis;
+					int sz = i / (samplesPerAxis * samplesPerAxis);
+					positions[i] = corner + vector3(static_cast<float>(sx), static_cast<float>(sy), static_cast<float>(sz)) * voxelSize;
+				}
+
+				size_t first = m_brickSamples.size();
+				m_brickSamples.resize(first + samplesPerBrick);
+				for (int i = 0; i < samplesPerBrick; i += 4)
+				{
+					vector3x4 p;
+					float px[4];
+					float py[4];
+					float pz[4];
+					for (int lane = 0; lane < 4; ++lane)
+					{
+						const vector3 &q = positions[std::min(i + lane, samplesPerBrick - 1)];
+						px[lane] = q.x;
+						py[lane] = q.y;
+						pz[lane] = q.z;
+					}
+					p = vector3x4(vfloat4(px[0], px[1], px[2], px[3]), vfloat4(py[0], py[1], py[2], py[3]), vfloat4(pz[0], pz[1], pz[2], pz[3]));
+					float d[4];
+					m_root->Distance4(p).Store(d);
+					for (int lane = 0; lane < 4 && i + lane < samplesPerBrick; ++lane)
+					{
+						m_brickSamples[first + i + lane] = d[lane];
+					}
+				}
+
+				// conservative fields such as the terrain change much slower than 1 per unit, so the
+				// interpolation error is bounded by the largest change between neighbouring samples
+				const float *samples = &m_brickSamples[first];
+				float maxStep = 0.0f;
+				for (int i = 0; i < samplesPerBrick; ++i)
+				{
+					int sx = i % samplesPerAxis;
+					int sy = (i / samplesPerAxis) % samplesPerAxis;
+					int sz = i / (samplesPerAxis * samplesPerAxis);
+					if (sx + 1 < samplesPerAxis) maxStep = std::max(maxStep, std::abs(samples[i + 1] - samples[i]));
+					if (sy + 1 < samplesPerAxis) maxStep = std::max(maxStep, std::abs(samples[i + samplesPerAxis] - samples[i]));
+					if (sz + 1 < samplesPerAxis) maxStep = std::max(maxStep, std::abs(samples[i + samplesPerAxis * samplesPerAxis] - samples[i]));
+				}
+				const float margin = std::min(maxStep * 2.0f * std::sqrt(3.0f), std::sqrt(3.0f) * voxelSize);
+
+				// no sign change and clear of the surface everywhere, the brick is empty after all
+				float minDistance = samples[0];
+				float maxDistance = samples[0];
+				for (int i = 1; i < samplesPerBrick; ++i)
+				{
+					minDistance = std::min(minDistance, samples[i]);
+					maxDistance = std::max(maxDistance, samples[i]);
+				}
+				if (minDistance > margin || maxDistance < -margin)
+				{
+					m_brickIndex[(z * m_gridSize[1] + y) * m_gridSize[0] + x] = -1;
+					m_brickSamples.resize(first);
+					continue;
+				}
+				m_brickMargins.push_back(margin);
+			}
+		}
+	}
+}
+
+size_t SdfShape::GetBrickCacheBytes() const
+{
+	return m_brickIndex.size() * sizeof(int32_t) + (m_brickSamples.size() + m_brickMargins.size()) * sizeof(float);
+}
+
+float SdfShape::CachedStep(const vector3 &p, const vector3 &direction, bool *nearSurface) const
+{
+	const vector3 local = (p - m_bounds.min) / m_brickSize;
+	const int cell[3] =
+	{
+		std::min(std::max(static_cast<int>(local.x), 0), m_gridSize[0] - 1),
+		std::min(std::max(static_cast<int>(local.y), 0), m_gridSize[1] - 1),
+		std::min(std::max(static_cast<int>(local.z), 0), m_gridSize[2] - 1),
+	};
+	const int32_t brick = m_brickIndex[(cell[2] * m_gridSize[1] + cell[1]) * m_gridSize[0] + cell[0]];
+
+	if (brick < 0)
+	{
+		// nothing in here, step straight to where the ray leaves the brick
+		*nearSurface = false;
+		const float position[3] = { local.x, local.y, local.z };
+		const float dir[3] = { direction.x, direction.y, direction.z };
+		float exit = std::numeric_limits<float>::infinity();
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (dir[axis] > 0.0f) exit = std::min(exit, (cell[axis] + 1 - position[axis]) / dir[axis]);
+			else if (dir[axis] < 0.0f) exit = std::min(exit, (cell[axis] - position[axis]) / dir[axis]);
+		}
+		return (std::max(exit, 0.0f) + 1e-3f) * m_brickSize;
+	}
+
+	const int samplesPerAxis = m_brickResolution + 1;
+	const float *samples = &m_brickSamples[static_cast<size_t>(brick) * samplesPerAxis * samplesPerAxis * samplesPerAxis];
+	const float gx = clamp((local.x - cell[0]) * m_brickResolution, 0.0f, static_cast<float>(m_brickResolution) - 1e-4f);
+	const float gy = clamp((local.y - cell[1]) * m_brickResolution, 0.0f, static_cast<float>(m_brickResolution) - 1e-4f);
+	const float gz = clamp((local.z - cell[2]) * m_brickResolution, 0.0f, static_cast<float>(m_brickResolution) - 1e-4f);
+	const int ix = static_cast<int>(gx);
+	const int iy = static_cast<int>(gy);
+	const int iz = static_cast<int>(gz);
+	const float fx = gx - ix;
+	const float fy = gy - iy;
+	const float fz = gz - iz;
+	auto sample = [&](int dx, int dy, int dz)
+	{
+		return samples[((iz + dz) * samplesPerAxis + iy + dy) * samplesPerAxis + ix + dx];
+	};
+	const float d = lerp(
+		lerp(lerp(sample(0, 0, 0), sample(1, 0, 0), fx), lerp(sample(0, 1, 0), sample(1, 1, 0), fx), fy),
+		lerp(lerp(sample(0, 0, 1), sample(1, 0, 1), fx), lerp(sample(0, 1, 1), sample(1, 1, 1), fx), fy), fz);
+
+	// close to the surface the caller checks the exact field at least every half voxel
+	const float margin = m_brickMargins[brick];
+	*nearSurface = d <= 2.0f * margin;
+	return std::max(d - margin, 0.5f * m_brickSize / m_brickResolution);
+}
+
+float SdfShape::Refine(const Ray &ray, float side, float tOutside, float tInside) const
+{
+	for (int i = 0; i < maxRefineSteps; ++i)
+	{
+		float tMid = 0.5f * (tOutside + tInside);
+		float d = side * Distance(ray.origin + ray.direction * tMid);
+		if (d >= 0.0f && d < m_epsilon)
+		{
+			return tMid;
+		}
+		(d > 0.0f ? tOutside : tInside) = tMid;
+	}
+	// stay in front of the surface, a hit behind it would send the next ray off on the wrong side
+	return tOutside;
+}
+
+bool SdfShape::Intersect(const Ray &ray, float *t, Hit *h)
+{
+	float t0;
+	float t1;
+	if (!m_bounds.Intersect(ray, &t0, &t1)) return false;
+
+	const float rcpDirLength = 1.0f / ray.direction.length();
+	const vector3 direction = ray.direction * rcpDirLength;
+
+	float tCurrent = t0;
+	float tHit = -1.0f;
+	int step = 0;
+	float d = Distance(ray.origin + ray.direction * tCurrent);
+	float side = d < 0.0f ? -1.0f : 1.0f;
+	if (std::abs(d) < m_epsilon)
+	{
+		// rays leaving the surface start within epsilon of it, the gradient tells which side they leave to.
+		// Step off until the field clearly grows, a conservative field can take a while to get there
+		const vector3 origin = ray.origin + ray.direction * tCurrent;
+		side = direction.dot(Gradient(origin, m_epsilon)) < 0.0f ? -1.0f : 1.0f;
+		for (float distance = side * d; distance < 2.0f * m_epsilon && step < maxSteps; ++step)
+		{
+			if (distance < -m_epsilon)
+			{
+				tHit = tCurrent;
+				break;
+			}
+			tCurrent += std::max(distance, m_epsilon) * rcpDirLength;
+			distance = side * Distance(ray.origin + ray.direction * tCurrent);
+		}
+	}
+	const bool useCache = side > 0.0f && !m_brickIndex.empty();
+	// blurry paths cannot tell a hit within a fraction of their cone from an exact one. Only the spread
+	// counts, the width the cone starts with would accept the surface the ray leaves
+	const float coarseEpsilon = ray.coarse ? coarseHitFraction * ray.coneSpread * ray.direction.length() : 0.0f;
+
+	// hits lie past tPrevious, once that reaches tMax they would be dropped anyway. Shadow rays end there
+	float tPrevious = tCurrent;
+	for (; tHit < 0.0f && step < maxSteps && tCurrent <= t1 && tPrevious < ray.tMax; ++step)
+	{
+		const vector3 p = ray.origin + ray.direction * tCurrent;
+		float minStep = 0.0f;
+		if (useCache)
+		{
+			bool nearSurface;
+			minStep = CachedStep(p, direction, &nearSurface);
+			if (!nearSurface)
+			{
+				tPrevious = tCurrent;
+				tCurrent += minStep * rcpDirLength;
+				continue;
+			}
+		}
+
+		float distance = side * Distance(p);
+		if (distance < std::max(m_epsilon, coarseEpsilon * tCurrent))
+		{
+			// strides longer than the distance can end up behind the surface
+			tHit = distance < 0.0f && tPrevious < tCurrent ? Refine(ray, side, tPrevious, tCurrent) : tCurrent;
+			break;
+		}
+		tPrevious = tCurrent;
+		tCurrent += std::max(distance, minStep) * rcpDirLength;
+	}
+
+	if (tHit <= 0.0f || tHit >= ray.tMax) return false;
+
+	*t = tHit;
+	if (h)
+	{
+		h->position = ray.origin + ray.direction * tHit;
+		h->normal = Gradient(h->position, m_epsilon).normalized();
+		h->u = h->position.x;
+		h->v = h->position.z;
+		h->uvDensity = 1.0f;
+	}
+	return true;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "bounds.h"
+#include "shape.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Four points evaluated together, one per lane.
+class vector3x4
+{
+public:
+	vector3x4() {}
+	vector3x4(const vfloat4 &x_, const vfloat4 &y_, const vfloat4 &z_): x(x_), y(y_), z(z_) {}
+	vector3x4(const vector3 &p): x(p.x), y(p.y), z(p.z) {}
+
+	vfloat4 x;
+	vfloat4 y;
+	vfloat4 z;
+};
+
+// Node of a signed distance expression. Distance must never overestimate the distance to the
+// surface (negative inside), underestimating only costs marching steps.
+class SdfNode
+{
+public:
+	virtual ~SdfNode() {}
+	virtual float Distance(const vector3 &p) const = 0;
+	// Distance of four points at once, nodes without a SIMD path evaluate lane by lane.
+	virtual vfloat4 Distance4(const vector3x4 &p) const;
+	virtual AABB GetBounds() const = 0;
+	virtual std::unique_ptr<SdfNode> Clone() const = 0;
+};
+
+class SdfSphere: public SdfNode
+{
+public:
+	SdfSphere(vector3 center, float radius): m_center(center), m_radius(radius) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override { return std::make_unique<SdfSphere>(*this); }
+
+private:
+	vector3 m_center;
+	float m_radius;
+};
+
+// Box with rounded edges, halfExtent includes the rounding radius.
+class SdfBox: public SdfNode
+{
+public:
+	SdfBox(vector3 center, vector3 halfExtent, float rounding = 0.0f): m_center(center), m_halfExtent(halfExtent), m_rounding(rounding) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override { return std::make_unique<SdfBox>(*this); }
+
+private:
+	vector3 m_center;
+	vector3 m_halfExtent;
+	float m_rounding;
+};
+
+// Torus around the y axis through center.
+class SdfTorus: public SdfNode
+{
+public:
+	SdfTorus(vector3 center, float majorRadius, float minorRadius): m_center(center), m_majorRadius(majorRadius), m_minorRadius(minorRadius) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override { return std::make_unique<SdfTorus>(*this); }
+
+private:
+	vector3 m_center;
+	float m_majorRadius;
+	float m_minorRadius;
+};
+
+class SdfUnion: public SdfNode
+{
+public:
+	SdfUnion(std::unique_ptr<SdfNode> &&a, std::unique_ptr<SdfNode> &&b): m_a(std::move(a)), m_b(std::move(b)) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override;
+
+private:
+	std::unique_ptr<SdfNode> m_a;
+	std::unique_ptr<SdfNode> m_b;
+};
+
+// Polynomial smooth minimum, blends the two surfaces over a band of width k.
+class SdfSmoothUnion: public SdfNode
+{
+public:
+	SdfSmoothUnion(std::unique_ptr<SdfNode> &&a, std::unique_ptr<SdfNode> &&b, float k): m_a(std::move(a)), m_b(std::move(b)), m_k(k) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override;
+
+private:
+	std::unique_ptr<SdfNode> m_a;
+	std::unique_ptr<SdfNode> m_b;
+	float m_k;
+};
+
+// Carves b out of a.
+class SdfSubtract: public SdfNode
+{
+public:
+	SdfSubtract(std::unique_ptr<SdfNode> &&a, std::unique_ptr<SdfNode> &&b): m_a(std::move(a)), m_b(std::move(b)) {}
+	float Distance(const vector3 &p) const override;
+	vfloat4 Distance4(const vector3x4 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override;
+
+private:
+	std::unique_ptr<SdfNode> m_a;
+	std::unique_ptr<SdfNode> m_b;
+};
+
+// Fractal value noise height field over a square patch of the xz plane. The vertical distance is
+// scaled by the worst case slope of the noise so the field stays conservative.
+class SdfTerrain: public SdfNode
+{
+public:
+	SdfTerrain(vector3 center, float halfSize, float amplitude, float frequency, int octaves, uint32_t seed = 0);
+	float Distance(const vector3 &p) const override;
+	AABB GetBounds() const override;
+	std::unique_ptr<SdfNode> Clone() const override { return std::make_unique<SdfTerrain>(*this); }
+
+	float Height(float x, float z) const;
+
+private:
+	float Noise(float x, float z) const;
+
+	vector3 m_center;
+	float m_halfSize;
+	float m_amplitude;
+	float m_frequency;
+	int m_octaves;
+	uint32_t m_seed;
+	float m_maxHeight;
+	float m_distanceScale;
+};
+
+// Shape bounded by the zero set of a distance expression, intersected by sphere tracing inside
+// its bounding box.
+class SdfShape: public Shape
+{
+public:
+	SdfShape(std::unique_ptr<SdfNode> &&root, float epsilon = 1e-4f);
+	SdfShape(const SdfShape &other);
+	~SdfShape() override {}
+	bool Intersect(const Ray &r, float *t, Hit *h) override;
+	std::unique_ptr<Shape> Clone() const override { return std::make_unique<SdfShape>(*this); }
+	AABB GetBounds() const override { return m_bounds; }
+	size_t GetMemoryBytes() const override { return sizeof(*this) + GetBrickCacheBytes(); }
+
+	// Samples the field into bricks of brickResolution^3 cells on a grid of resolution bricks along
+	// the longest axis of the bounds. Only bricks the surface passes through keep their samples,
+	// marching skips the others without evaluating the expression. Inside the others it walks the
+	// samples and strides at least half a voxel along the exact field near the surface, features
+	// thinner than that can be lost.
+	void BuildBrickCache(int resolution = 32, int brickResolution = 8);
+	size_t GetBrickCacheBytes() const;
+
+	float Distance(const vector3 &p) const { return m_root->Distance(p); }
+	// Central differences on a tetrahedron, the four samples are evaluated in one SIMD call.
+	vector3 Gradient(const vector3 &p, float h) const;
+
+	static const int maxSteps = 512;
+	static const int maxRefineSteps = 16;
+	// rays flagged coarse accept hits within this fraction of the cone spread times the distance
+	static constexpr float coarseHitFraction = 1.0f / 64.0f;
+
+private:
+	// Marching step at p taken from the cache. Near the surface it is only a stride, the exact
+	// field has to be checked before taking it.
+	float CachedStep(const vector3 &p, const vector3 &direction, bool *nearSurface) const;
+	// Bisection on the exact field between a point in front of the surface and one behind it.
+	float Refine(const Ray &ray, float side, float tOutside, float tInside) const;
+
+	std::unique_ptr<SdfNode> m_root;
+	AABB m_bounds;
+	float m_epsilon;
+
+	// brick cache
+	int m_gridSize[3] = { 0, 0, 0 };
+	int m_brickResolution = 0;
+	float m_brickSize = 0.0f;
+	std::vector<int32_t> m_brickIndex; // per grid cell, -1 for cells the surface does not pass through
+	std::vector<float> m_brickSamples; // (brickResolution + 1)^3 corner samples per surface brick
+	std::vector<float> m_brickMargins; // per surface brick, how far interpolated samples may be off
+};
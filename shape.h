@@ -1,12 +1,23 @@
 #pragma once
 
+#include "bounds.h"
 #include "ray.h"
 #include "hit.h"
 
+#include <memory>
+
+class Hit;
+
 class Shape
 {
 public:
 	Shape() {}
 	virtual ~Shape() {}
 	virtual bool Intersect(const Ray &r, float *t, Hit *h) = 0;
+	// True for any hit closer than r.tMax, shapes that can stop at the first one they find override it.
+	virtual bool Occluded(const Ray &r) { float t; return Intersect(r, &t, nullptr); }
+	virtual std::unique_ptr<Shape> Clone() const = 0;
+	virtual AABB GetBounds() const = 0;
+	virtual size_t GetMemoryBytes() const = 0;
+	virtual size_t GetPrimitiveCount() const { return 1; }
 };
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Four floats processed in lock step, SSE backed where available with a scalar fallback.
+class vfloat4
+{
+public:
+	vfloat4() {}
+#ifdef RT_SSE
+	vfloat4(__m128 v_): v(v_) {}
+	vfloat4(float f): v(_mm_set1_ps(f)) {}
+	vfloat4(float a, float b, float c, float d): v(_mm_setr_ps(a, b, c, d)) {}
+	float operator[](int i) const { alignas(16) float f[4]; _mm_store_ps(f, v); return f[i]; }
+	void Store(float *f) const { _mm_storeu_ps(f, v); }
+
+	__m128 v;
+#else
+	vfloat4(float f): v{ f, f, f, f } {}
+	vfloat4(float a, float b, float c, float d): v{ a, b, c, d } {}
+	float operator[](int i) const { return v[i]; }
+	void Store(float *f) const { for (int i = 0; i < 4; ++i) f[i] = v[i]; }
+
+	float v[4];
+#endif
+};
+
+#ifdef RT_SSE
+inline vfloat4 operator+(const vfloat4 &a, const vfloat4 &b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat4 operator-(const vfloat4 &a, const vfloat4 &b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat4 operator*(const vfloat4 &a, const vfloat4 &b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat4 operator/(const vfloat4 &a, const vfloat4 &b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat4 operator-(const vfloat4 &a) { return _mm_sub_ps(_mm_setzero_ps(), a.v); }
+inline vfloat4 min(const vfloat4 &a, const vfloat4 &b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat4 max(const vfloat4 &a, const vfloat4 &b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat4 sqrt(const vfloat4 &a) { return _mm_sqrt_ps(a.v); }
+inline vfloat4 abs(const vfloat4 &a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+// One bit per lane, set where a <= b.
+inline int lessEqualMask(const vfloat4 &a, const vfloat4 &b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+#else
+#define RT_VFLOAT4_OP(expr) vfloat4 r; for (int i = 0; i < 4; ++i) r.v[i] = expr; return r
+inline vfloat4 operator+(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] + b.v[i]); }
+inline vfloat4 operator-(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] - b.v[i]); }
+inline vfloat4 operator*(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] * b.v[i]); }
+inline vfloat4 operator/(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] / b.v[i]); }
+inline vfloat4 operator-(const vfloat4 &a) { RT_VFLOAT4_OP(-a.v[i]); }
+inline vfloat4 min(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+inline vfloat4 max(const vfloat4 &a, const vfloat4 &b) { RT_VFLOAT4_OP(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+inline vfloat4 sqrt(const vfloat4 &a) { RT_VFLOAT4_OP(std::sqrt(a.v[i])); }
+inline vfloat4 abs(const vfloat4 &a) { RT_VFLOAT4_OP(std::abs(a.v[i])); }
+#undef RT_VFLOAT4_OP
+inline int lessEqualMask(const vfloat4 &a, const vfloat4 &b)
+{
+	int mask = 0;
+	for (int i = 0; i < 4; ++i) mask |= (a.v[i] <= b.v[i] ? 1 : 0) << i;
+	return mask;
+}
+#endif
+
+inline vfloat4 clamp(const vfloat4 &a, const vfloat4 &lo, const vfloat4 &hi) { return min(max(a, lo), hi); }
@@ -0,0 +1,124 @@
+#include "spectrum.h"
+
+#include <cmath>
+
+vector3 Spectrum::ToVector3() const
+{
+	float f[4];
+	v.Store(f);
+	return vector3(f[0], f[1], f[2]);
+}
+
+static float smoothstep(float edge0, float edge1, float x)
+{
+	float t = clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+static float piecewiseGaussian(float lambda, float mu, float sigma1, float sigma2)
+{
+	float t = (lambda - mu) / (lambda < mu ? sigma1 : sigma2);
+	return std::exp(-0.5f * t * t);
+}
+
+// multi-lobe fit of the CIE 1931 colour matching functions (Wyman, Sloan and Shirley 2013)
+static vector3 colorMatching(float lambda)
+{
+	return vector3(
+		1.056f * piecewiseGaussian(lambda, 599.8f, 37.9f, 31.0f) + 0.362f * piecewiseGaussian(lambda, 442.0f, 16.0f, 26.7f)
+			- 0.065f * piecewiseGaussian(lambda, 501.1f, 20.4f, 26.2f),
+		0.821f * piecewiseGaussian(lambda, 568.8f, 46.9f, 40.5f) + 0.286f * piecewiseGaussian(lambda, 530.9f, 16.3f, 31.1f),
+		1.217f * piecewiseGaussian(lambda, 437.0f, 11.8f, 36.0f) + 0.681f * piecewiseGaussian(lambda, 459.0f, 26.0f, 13.8f));
+}
+
+static vector3 xyzToLinearSRGB(const vector3 &xyz)
+{
+	return vector3(
+		3.2406f * xyz.x - 1.5372f * xyz.y - 0.4986f * xyz.z,
+		-0.9689f * xyz.x + 1.8758f * xyz.y + 0.0415f * xyz.z,
+		0.0557f * xyz.x - 0.2040f * xyz.y + 1.0570f * xyz.z);
+}
+
+static void basisWeights(float lambda, float *red, float *green, float *blue)
+{
+	// a partition of unity, so colors in [0, 1] stay valid reflectances and white stays exactly 1
+	*blue = 1.0f - smoothstep(470.0f, 530.0f, lambda);
+	*red = smoothstep(570.0f, 620.0f, lambda);
+	*green = 1.0f - *blue - *red;
+}
+
+// XYZ to the RGB space of the renderer. The basis spectra of FromRGB are integrated once and the
+// matrix is calibrated so they come back as the pure primaries, linear combinations of RGB colors
+// (emission, sky, a single bounce) therefore look the same in both modes.
+struct OutputTransform
+{
+	OutputTransform()
+	{
+		vector3 basis[3];
+		for (float lambda = SampledWavelengths::minLambda; lambda <= SampledWavelengths::maxLambda; lambda += 1.0f)
+		{
+			float weight[3];
+			basisWeights(lambda, &weight[0], &weight[1], &weight[2]);
+			for (int i = 0; i < 3; ++i)
+			{
+				basis[i] += xyzToLinearSRGB(colorMatching(lambda)) * weight[i];
+			}
+		}
+
+		// invert the 3x3 matrix whose columns are the basis colors
+		const vector3 &a = basis[0];
+		const vector3 &b = basis[1];
+		const vector3 &c = basis[2];
+		vector3 r0 = b.cross(c);
+		vector3 r1 = c.cross(a);
+		vector3 r2 = a.cross(b);
+		float rcpDet = 1.0f / a.dot(r0);
+		rows[0] = r0 * rcpDet;
+		rows[1] = r1 * rcpDet;
+		rows[2] = r2 * rcpDet;
+	}
+
+	vector3 Apply(const vector3 &xyz) const
+	{
+		vector3 rgb = xyzToLinearSRGB(xyz);
+		return vector3(rows[0].dot(rgb), rows[1].dot(rgb), rows[2].dot(rgb));
+	}
+
+	vector3 rows[3];
+};
+
+static const OutputTransform outputTransform;
+
+SampledWavelengths::SampledWavelengths(float u)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		float offset = u + 0.25f * i;
+		offset -= std::floor(offset);
+		lambda[i] = minLambda + offset * (maxLambda - minLambda);
+	}
+}
+
+Spectrum SampledWavelengths::FromRGB(const vector3 &rgb) const
+{
+	float s[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		float red, green, blue;
+		basisWeights(lambda[i], &red, &green, &blue);
+		s[i] = rgb.x * red + rgb.y * green + rgb.z * blue;
+	}
+	return Spectrum(vfloat4(s[0], s[1], s[2], s[3]));
+}
+
+vector3 SampledWavelengths::ToRGB(const Spectrum &s) const
+{
+	// uniform wavelength pdf, the 1 nm calibration integral absorbs the range
+	vector3 xyz;
+	for (int i = 0; i < 4; ++i)
+	{
+		xyz += colorMatching(lambda[i]) * s[i];
+	}
+	xyz *= 0.25f * (maxLambda - minLambda);
+	return outputTransform.Apply(xyz);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "math.h"
+#include "simd.h"
+
+// Color carried through the path in one SIMD register. In RGB mode lanes 0-2 hold red, green
+// and blue and lane 3 is carried along but ignored, in spectral mode the lanes are the values at
+// the four wavelengths of a SampledWavelengths.
+class Spectrum
+{
+public:
+	Spectrum(): v(0.0f) {}
+	explicit Spectrum(float f): v(f) {}
+	Spectrum(const vfloat4 &v_): v(v_) {}
+	explicit Spectrum(const vector3 &rgb): v(rgb.x, rgb.y, rgb.z, 0.0f) {}
+
+	float operator[](int i) const { return v[i]; }
+	vector3 ToVector3() const;
+
+	Spectrum &operator+=(const Spectrum &o) { v = v + o.v; return *this; }
+	Spectrum &operator-=(const Spectrum &o) { v = v - o.v; return *this; }
+	Spectrum &operator*=(const Spectrum &o) { v = v * o.v; return *this; }
+	Spectrum &operator*=(float f) { v = v * vfloat4(f); return *this; }
+	Spectrum &operator/=(float f) { v = v * vfloat4(1.0f / f); return *this; }
+
+	vfloat4 v;
+};
+
+inline Spectrum operator+(const Spectrum &a, const Spectrum &b) { return a.v + b.v; }
+inline Spectrum operator-(const Spectrum &a, const Spectrum &b) { return a.v - b.v; }
+inline Spectrum operator*(const Spectrum &a, const Spectrum &b) { return a.v * b.v; }
+inline Spectrum operator/(const Spectrum &a, const Spectrum &b) { return a.v / b.v; }
+inline Spectrum operator*(const Spectrum &a, float f) { return a.v * vfloat4(f); }
+inline Spectrum operator*(float f, const Spectrum &a) { return a.v * vfloat4(f); }
+inline Spectrum operator/(const Spectrum &a, float f) { return a.v * vfloat4(1.0f / f); }
+inline Spectrum lerp(const Spectrum &a, const Spectrum &b, float t) { return a.v + (b.v - a.v) * vfloat4(t); }
+
+// Hero wavelength sampling: one uniformly chosen wavelength plus three more rotated by a quarter of
+// the visible range, so every path sees the whole spectrum.
+class SampledWavelengths
+{
+public:
+	static constexpr float minLambda = 380.0f;
+	static constexpr float maxLambda = 720.0f;
+
+	SampledWavelengths(float u);
+
+	// Smooth reflectance or emission spectrum of an RGB colour, white stays exactly 1 everywhere.
+	Spectrum FromRGB(const vector3 &rgb) const;
+	// Monte Carlo estimate of the linear RGB value of the spectrum, FromRGB colors map back to themselves.
+	vector3 ToRGB(const Spectrum &s) const;
+
+	float lambda[4];
+};
+
+// Compensated (Kahan) sum, keeps long accumulations from drifting.
+class SpectrumSum
+{
+public:
+	void Add(const Spectrum &x)
+	{
+		Spectrum y = x - m_compensation;
+		Spectrum t = m_sum + y;
+		m_compensation = (t - m_sum) - y;
+		m_sum = t;
+	}
+	const Spectrum &Get() const { return m_sum; }
+
+private:
+	Spectrum m_sum;
+	Spectrum m_compensation;
+};
@@ -47,6 +47,9 @@ bool Sphere::Intersect(const Ray &ray, float *t, Hit *h)
 	{
 		h->position = ray.origin + ray.direction * (*t);
 		h->normal = (h->position - m_center).normalized();
+		h->u = 0.5f + std::atan2(h->normal.z, h->normal.x) * 0.5f * rcpPi;
+		h->v = std::acos(clamp(h->normal.y, -1.0f, 1.0f)) * rcpPi;
+		h->uvDensity = rcpPi / m_radius;
 	}
 
 	return true;
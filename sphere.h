@@ -10,6 +10,9 @@ public:
 	Sphere(vector3 center, float radius): m_center(center), m_radius(radius) {}
 	~Sphere() override {}
 	bool Intersect(const Ray &r, float *t, Hit *h) override;
+	std::unique_ptr<Shape> Clone() const override { return std::make_unique<Sphere>(*this); }
+	AABB GetBounds() const override { return AABB(m_center - vector3(m_radius), m_center + vector3(m_radius)); }
+	size_t GetMemoryBytes() const override { return sizeof(*this); }
 
 	vector3 m_center;
 	float m_radius;
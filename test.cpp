@@ -0,0 +1,939 @@
+#include "bsdf.h"
+#include "envmap.h"
+#include "hit.h"
+#include "integrator.h"
+#include "material.h"
+#include "math.h"
+#include "mesh.h"
+#include "plane.h"
+#include "renderer.h"
+#include "sampling.h"
+#include "scene.h"
+#include "sphere.h"
+#include "texturecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Correctness and speed checks, run with make check. Scene tests render small scenes in several
+// independent runs and compare them with high sample references in tests/. Run with
+// --update-references to render the references again and to record the current runtimes as the
+// baseline that later runs are compared with.
+
+static const char *referenceDirectory = "tests/";
+static const char *timingsFile = "tests/timings.txt";
+// a test this much slower than its baseline is flagged, it does not fail
+static const double slowFactor = 1.5;
+static const double slowMargin = 0.05; // seconds, keeps the fast unit tests from flagging on noise
+
+static bool updateReferences = false;
+
+static bool near(float a, float b, float tolerance)
+{
+	return std::abs(a - b) <= tolerance;
+}
+
+static bool near(const vector3 &a, const vector3 &b, float tolerance)
+{
+	return near(a.x, b.x, tolerance) && near(a.y, b.y, tolerance) && near(a.z, b.z, tolerance);
+}
+
+// Records the first failed expectation of a test.
+class Expect
+{
+public:
+	void operator()(bool condition, const std::string &what)
+	{
+		if (!condition && m_failure.empty())
+		{
+			m_failure = what;
+		}
+	}
+	bool Passed() const { return m_failure.empty(); }
+	const std::string &GetFailure() const { return m_failure; }
+
+private:
+	std::string m_failure;
+};
+
+static bool testSphereIntersect(std::string *details)
+{
+	Expect expect;
+	Sphere sphere(vector3(0.0f, 0.0f, -5.0f), 1.0f);
+	float t = 0.0f;
+	Hit hit;
+
+	Ray ray(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f));
+	expect(sphere.Intersect(ray, &t, &hit), "ray towards the center misses");
+	expect(near(t, 4.0f, 1e-5f), "front hit distance");
+	expect(near(hit.position, vector3(0.0f, 0.0f, -4.0f), 1e-5f), "front hit position");
+	expect(near(hit.normal, vector3(0.0f, 0.0f, 1.0f), 1e-5f), "front hit normal");
+
+	Ray inside(vector3(0.0f, 0.0f, -5.0f), vector3(0.0f, 1.0f, 0.0f));
+	expect(sphere.Intersect(inside, &t, &hit) && near(t, 1.0f, 1e-5f), "ray from the center leaves at the radius");
+	expect(near(hit.normal, vector3(0.0f, 1.0f, 0.0f), 1e-5f), "exit normal points outwards");
+
+	// off center: x = 0.6 enters where z = -5 + 0.8
+	Ray offset(vector3(0.6f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f));
+	expect(sphere.Intersect(offset, &t, &hit) && near(t, 4.2f, 1e-4f), "off center hit distance");
+	expect(near(hit.normal, vector3(0.6f, 0.0f, 0.8f), 1e-4f), "off center normal");
+
+	// unnormalized directions measure t in their own length
+	Ray scaled(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -2.0f));
+	expect(sphere.Intersect(scaled, &t, nullptr) && near(t, 2.0f, 1e-5f), "unnormalized direction");
+
+	Ray away(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f));
+	expect(!sphere.Intersect(away, &t, &hit), "sphere behind the ray is hit");
+	Ray past(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 1.0f, 0.0f));
+	expect(!sphere.Intersect(past, &t, &hit), "ray passing by hits");
+	Ray grazing(vector3(1.001f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f));
+	expect(!sphere.Intersect(grazing, &t, &hit), "ray just outside the silhouette hits");
+	Ray shortRay(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f));
+	shortRay.tMax = 3.5f;
+	expect(!sphere.Intersect(shortRay, &t, &hit), "hit beyond tMax");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+static bool testPlaneIntersect(std::string *details)
+{
+	Expect expect;
+	Plane plane(vector3(0.0f, 1.0f, 0.0f), -0.5f);
+	float t = 0.0f;
+	Hit hit;
+
+	Ray down(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, -1.0f, 0.0f));
+	expect(plane.Intersect(down, &t, &hit), "ray towards the plane misses");
+	expect(near(t, 0.5f, 1e-6f), "hit distance");
+	expect(near(hit.position, vector3(0.0f, -0.5f, 0.0f), 1e-6f), "hit position");
+	expect(near(hit.normal, vector3(0.0f, 1.0f, 0.0f), 1e-6f), "hit normal");
+
+	Ray oblique(vector3(1.0f, 0.0f, 2.0f), vector3(1.0f, -1.0f, 0.0f).normalized());
+	expect(plane.Intersect(oblique, &t, &hit) && near(t, 0.5f * std::sqrt(2.0f), 1e-5f), "oblique hit distance");
+	expect(near(hit.position, vector3(1.5f, -0.5f, 2.0f), 1e-5f), "oblique hit position");
+
+	Ray below(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 1.0f, 0.0f));
+	expect(plane.Intersect(below, &t, &hit) && near(t, 0.5f, 1e-6f), "ray from below misses");
+
+	Ray up(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, 1.0f, 0.0f));
+	expect(!plane.Intersect(up, &t, &hit), "plane behind the ray is hit");
+	Ray parallel(vector3(0.0f, 0.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f));
+	expect(!plane.Intersect(parallel, &t, &hit), "parallel ray hits");
+	Ray shortRay(vector3(0.0f, 0.0f, 0.0f), vector3(0.0f, -1.0f, 0.0f));
+	shortRay.tMax = 0.25f;
+	expect(!plane.Intersect(shortRay, &t, &hit), "hit beyond tMax");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// A compressed mesh with its vertices in random order hits what the plain one hits, within the
+// quantization, and needs less than half of its memory.
+static bool testMeshCompression(std::string *details)
+{
+	static const int gridSize = 120;
+
+	Expect expect;
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	std::vector<uint32_t> numbers(gridSize * gridSize);
+	for (uint32_t i = 0; i < numbers.size(); ++i)
+	{
+		numbers[i] = i;
+	}
+	std::shuffle(numbers.begin(), numbers.end(), gen);
+
+	std::vector<vector3> positions(numbers.size());
+	std::vector<vector3> normals(numbers.size());
+	for (int y = 0; y < gridSize; ++y)
+	{
+		for (int x = 0; x < gridSize; ++x)
+		{
+			const float u = static_cast<float>(x) / (gridSize - 1);
+			const float v = static_cast<float>(y) / (gridSize - 1);
+			positions[numbers[y * gridSize + x]] = vector3(u, 0.1f * std::sin(u * 9.0f) * std::cos(v * 7.0f), v);
+			normals[numbers[y * gridSize + x]] = vector3(0.0f, 1.0f, 0.0f);
+		}
+	}
+	std::vector<uint32_t> indices;
+	for (int y = 0; y + 1 < gridSize; ++y)
+	{
+		for (int x = 0; x + 1 < gridSize; ++x)
+		{
+			const uint32_t a = numbers[y * gridSize + x];
+			const uint32_t b = numbers[y * gridSize + x + 1];
+			const uint32_t c = numbers[(y + 1) * gridSize + x];
+			const uint32_t d = numbers[(y + 1) * gridSize + x + 1];
+			indices.insert(indices.end(), { a, c, b, b, c, d });
+		}
+	}
+
+	TriangleMesh plain(positions, normals, indices, false);
+	TriangleMesh compressed(positions, normals, indices, true);
+	const float ratio = static_cast<float>(plain.GetMemoryBytes()) / compressed.GetMemoryBytes();
+	expect(ratio >= 2.0f, "compressed mesh only " + std::to_string(ratio) + " times smaller");
+
+	int mismatches = 0;
+	for (int i = 0; i < 10000; ++i)
+	{
+		Ray ray(vector3(dis(gen), 1.0f, dis(gen)), vector3(dis(gen) - 0.5f, -1.0f, dis(gen) - 0.5f).normalized());
+		float tPlain = 0.0f;
+		float tCompressed = 0.0f;
+		Hit hitPlain;
+		Hit hitCompressed;
+		const bool found = plain.Intersect(ray, &tPlain, &hitPlain);
+		if (found != compressed.Intersect(ray, &tCompressed, &hitCompressed) || (found && !near(tPlain, tCompressed, 1e-3f)))
+		{
+			mismatches++;
+		}
+		else if (found != compressed.Occluded(ray))
+		{
+			mismatches++;
+		}
+	}
+	// rays grazing a quantized edge can go either way
+	expect(mismatches <= 10, std::to_string(mismatches) + " rays disagree");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+static bool testHammersley(std::string *details)
+{
+	Expect expect;
+	expect(radicalInverse_VdC(0) == 0.0f && radicalInverse_VdC(1) == 0.5f && radicalInverse_VdC(2) == 0.25f
+		&& radicalInverse_VdC(3) == 0.75f && radicalInverse_VdC(6) == 0.375f, "radical inverse of small integers");
+
+	// a power of two set is a (0, m, 2) net: every elementary box of area 1 / N holds one point
+	for (int log2N = 0; log2N <= 10; ++log2N)
+	{
+		const uint32_t N = 1u << log2N;
+		std::vector<float> a(N);
+		std::vector<float> b(N);
+		for (uint32_t i = 0; i < N; ++i)
+		{
+			hammersley(i, N, 0, &a[i], &b[i]);
+			expect(a[i] >= 0.0f && a[i] < 1.0f && b[i] >= 0.0f && b[i] < 1.0f, "point outside the unit square");
+			expect(a[i] == static_cast<float>(i) / N, "first coordinate is not i / N");
+		}
+		for (int log2X = 0; log2X <= log2N; ++log2X)
+		{
+			const uint32_t columns = 1u << log2X;
+			const uint32_t rows = N / columns;
+			std::vector<int> counts(N, 0);
+			for (uint32_t i = 0; i < N; ++i)
+			{
+				uint32_t x = static_cast<uint32_t>(a[i] * columns);
+				uint32_t y = static_cast<uint32_t>(b[i] * rows);
+				counts[y * columns + x]++;
+			}
+			expect(std::all_of(counts.begin(), counts.end(), [](int count) { return count == 1; }),
+				"elementary box without exactly one point, N = " + std::to_string(N) + ", " + std::to_string(columns) + " columns");
+		}
+	}
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// Directional albedo of the BSDF for white materials, estimated with its own sampling and with
+// uniform hemisphere sampling. Metals and dielectrics must not create energy, the Disney diffuse
+// lobe's retro-reflection is allowed its known gain at grazing angles on rough surfaces.
+static bool testBrdfEnergy(std::string *details)
+{
+	static const int sampleCount = 100000;
+	static const float tolerance = 0.01f;
+	static const float diffuseGain = 1.2f;
+
+	Expect expect;
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	const vector3 normal(0.0f, 1.0f, 0.0f);
+	for (float metalness : { 0.0f, 1.0f })
+	{
+		for (float roughness : { 0.05f, 0.3f, 0.6f, 1.0f })
+		{
+			for (float cosTheta : { 1.0f, 0.5f, 0.1f })
+			{
+				const vector3 wo(std::sqrt(1.0f - cosTheta * cosTheta), cosTheta, 0.0f);
+				Material material(vector3(1.0f, 1.0f, 1.0f), roughness, metalness);
+				BSDF bsdf(material, Spectrum(1.0f), normal, wo, false);
+
+				double sampled = 0.0;
+				double uniform = 0.0;
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					vector3 wi;
+					float pdf;
+					BSDF::Lobe lobe;
+					Spectrum f = bsdf.Sample(dis(gen), dis(gen), dis(gen), &wi, &pdf, &lobe);
+					if (pdf > 0.0f)
+					{
+						sampled += f[0] / pdf;
+					}
+
+					float z = dis(gen);
+					float phi = 2.0f * pi * dis(gen);
+					float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+					uniform += bsdf.Eval(vector3(r * std::cos(phi), z, r * std::sin(phi)))[0] * 2.0f * pi;
+				}
+				sampled /= sampleCount;
+				uniform /= sampleCount;
+
+				std::ostringstream name;
+				name << "metalness " << metalness << ", roughness " << roughness << ", cos theta " << cosTheta << ": albedo " << sampled;
+				expect(sampled <= (metalness > 0.0f ? 1.0f : diffuseGain) + tolerance, name.str() + " creates energy");
+				// the uniform estimate is too noisy for the sharp lobes
+				if (roughness >= 0.3f)
+				{
+					expect(std::abs(sampled - uniform) <= 0.02f * uniform, name.str() + ", uniform sampling gives " + std::to_string(uniform));
+				}
+			}
+		}
+	}
+
+	// a clear dielectric reflects or transmits everything
+	for (float cosTheta : { 1.0f, 0.5f, 0.1f, -0.5f })
+	{
+		const vector3 wo(std::sqrt(1.0f - cosTheta * cosTheta), cosTheta, 0.0f);
+		Material glass(vector3(1.0f, 1.0f, 1.0f), 0.0f, 0.0f);
+		glass.transmission = 1.0f;
+		BSDF bsdf(glass, Spectrum(1.0f), normal, wo, false);
+		double albedo = 0.0;
+		for (int i = 0; i < 1000; ++i)
+		{
+			vector3 wi;
+			float pdf;
+			BSDF::Lobe lobe;
+			Spectrum f = bsdf.Sample(dis(gen), dis(gen), dis(gen), &wi, &pdf, &lobe);
+			albedo += pdf > 0.0f ? f[0] / pdf : 0.0f;
+		}
+		expect(near(static_cast<float>(albedo / 1000.0), 1.0f, 1e-4f), "dielectric albedo at cos theta " + std::to_string(cosTheta));
+	}
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// Dispersive glass refracts the hero wavelength of a spectral path by its own index, blue bends
+// more than red. RGB paths see the plain index.
+static bool testDispersion(std::string *details)
+{
+	Expect expect;
+	const vector3 normal(0.0f, 1.0f, 0.0f);
+	const vector3 wo = vector3(1.0f, 1.0f, 0.0f).normalized();
+	Material glass(vector3(1.0f, 1.0f, 1.0f), 0.0f, 0.0f);
+	glass.transmission = 1.0f;
+	glass.dispersion = 0.0136f;
+	Material plain = glass;
+	plain.dispersion = 0.0f;
+
+	// e0 close to one refracts, the Fresnel reflectance at 45 degrees is a few percent
+	auto refract = [&](const Material &m, const SampledWavelengths *wavelengths, bool *dispersive)
+	{
+		BSDF bsdf(m, Spectrum(1.0f), normal, wo, false, wavelengths);
+		vector3 wi;
+		float pdf;
+		BSDF::Lobe lobe;
+		bsdf.Sample(0.5f, 0.99f, 0.5f, &wi, &pdf, &lobe);
+		*dispersive = bsdf.IsDispersive();
+		return wi;
+	};
+	auto heroAt = [](float lambda)
+	{
+		return SampledWavelengths((lambda - SampledWavelengths::minLambda) / (SampledWavelengths::maxLambda - SampledWavelengths::minLambda));
+	};
+
+	const SampledWavelengths blue = heroAt(420.0f);
+	const SampledWavelengths red = heroAt(680.0f);
+	bool blueDispersive;
+	bool redDispersive;
+	bool rgbDispersive;
+	bool plainDispersive;
+	const vector3 blueDirection = refract(glass, &blue, &blueDispersive);
+	const vector3 redDirection = refract(glass, &red, &redDispersive);
+	const vector3 rgbDirection = refract(glass, nullptr, &rgbDispersive);
+	const vector3 plainDirection = refract(plain, &blue, &plainDispersive);
+
+	expect(blueDirection.y < 0.0f && redDirection.y < 0.0f, "dispersive glass should refract");
+	expect(std::abs(blueDirection.x) < std::abs(redDirection.x) - 1e-3f, "blue should bend more than red");
+	expect(near(rgbDirection, plainDirection, 1e-6f), "RGB paths should ignore the dispersion");
+	expect(blueDispersive && redDispersive, "spectral paths should see the dispersion");
+	expect(!rgbDispersive && !plainDispersive, "RGB paths and plain glass should keep every wavelength");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// Tiled textures are checked when opened, truncated or corrupt files are refused instead of being
+// read past their end later.
+static bool testTextureValidation(std::string *details)
+{
+	Expect expect;
+	const std::filesystem::path directory = std::filesystem::temp_directory_path();
+	const std::string path = (directory / "rt_test_texture.rtt").string();
+	const std::string damaged = (directory / "rt_test_damaged.rtt").string();
+	std::vector<float> rgb(100 * 70 * 3, 0.5f);
+	expect(WriteTiledTexture(path, 100, 70, rgb.data(), false, 32), "cannot write " + path);
+
+	std::ifstream in(path, std::ifstream::binary);
+	std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	auto open = [&](const std::vector<char> &data)
+	{
+		std::ofstream(damaged, std::ofstream::binary).write(data.data(), data.size());
+		TextureCache cache(1 << 20);
+		int texture = cache.Open(damaged);
+		if (texture >= 0)
+		{
+			// every tile of every level has to be readable
+			const TiledTextureHeader &header = cache.GetHeader(texture);
+			for (uint32_t level = 0; level < header.levelCount; ++level)
+			{
+				const TiledTextureLevel &info = cache.GetLevel(texture, level);
+				for (uint32_t ty = 0; ty < info.tilesY; ++ty)
+				{
+					for (uint32_t tx = 0; tx < info.tilesX; ++tx)
+					{
+						cache.GetTile(texture, level, tx, ty);
+					}
+				}
+			}
+		}
+		return texture >= 0;
+	};
+
+	expect(open(bytes), "an intact texture should open");
+	std::vector<char> truncated(bytes.begin(), bytes.end() - 4096);
+	expect(!open(truncated), "a truncated texture should be refused");
+	std::vector<char> corrupt = bytes;
+	TiledTextureLevel *levels = reinterpret_cast<TiledTextureLevel *>(corrupt.data() + sizeof(TiledTextureHeader));
+	levels[1].offset = bytes.size();
+	expect(!open(corrupt), "a level past the end of the file should be refused");
+	corrupt = bytes;
+	reinterpret_cast<TiledTextureHeader *>(corrupt.data())->levelCount = 1000;
+	expect(!open(corrupt), "a level table past the end of the file should be refused");
+
+	std::filesystem::remove(path);
+	std::filesystem::remove(damaged);
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+static RenderSettings sceneSettings()
+{
+	RenderSettings settings;
+	settings.width = 64;
+	settings.height = 48;
+	settings.bounceCount = 6;
+	settings.denoise = false;
+	settings.fov = 40.0f;
+	settings.cameraOrigin = vector3(0.0f, 0.2f, 0.0f);
+	return settings;
+}
+
+static std::unique_ptr<Scene> buildDiffuseScene()
+{
+	SceneBuilder builder;
+	builder.SetAggregate(AggregateType::BVH);
+	Material *floor = builder.AddMaterial(vector3(0.7f, 0.7f, 0.7f), 1.0f, 0.0f);
+	Material *red = builder.AddMaterial(vector3(0.8f, 0.1f, 0.1f), 0.8f, 0.0f);
+	builder.SetSky(vector3(0.3f, 0.4f, 0.6f));
+	builder.AddPlane(vector3(0.0f, 1.0f, 0.0f), -0.5f, floor);
+	builder.AddSphere(vector3(0.0f, 0.0f, -3.0f), 0.5f, red);
+	builder.AddLight(vector3(-1.5f, 2.0f, -1.0f), vector3(1.0f, 1.0f, 1.0f), 10.0f);
+	return builder.Build();
+}
+
+static std::unique_ptr<Scene> buildMetalScene()
+{
+	SceneBuilder builder;
+	builder.SetAggregate(AggregateType::BVH);
+	Material *floor = builder.AddMaterial(vector3(0.5f, 0.5f, 0.5f), 0.7f, 0.0f);
+	Material *chrome = builder.AddMaterial(vector3(0.95f, 0.95f, 0.95f), 0.25f, 1.0f);
+	Material *gold = builder.AddMaterial(vector3(1.0f, 0.78f, 0.34f), 0.5f, 1.0f);
+	builder.SetSky(vector3(0.3f, 0.4f, 0.6f));
+	builder.AddPlane(vector3(0.0f, 1.0f, 0.0f), -0.5f, floor);
+	builder.AddSphere(vector3(-0.6f, 0.0f, -3.0f), 0.5f, chrome);
+	builder.AddSphere(vector3(0.6f, 0.0f, -3.0f), 0.5f, gold);
+	builder.AddLight(vector3(1.5f, 2.0f, -1.0f), vector3(1.0f, 1.0f, 1.0f), 10.0f);
+	return builder.Build();
+}
+
+static std::unique_ptr<Scene> buildGlassScene()
+{
+	SceneBuilder builder;
+	builder.SetAggregate(AggregateType::BVH);
+	Material *floor = builder.AddMaterial(vector3(0.7f, 0.7f, 0.7f), 1.0f, 0.0f);
+	Material *glass = builder.AddMaterial(vector3(1.0f, 1.0f, 1.0f), 0.0f, 0.0f);
+	glass->transmission = 1.0f;
+	Material *blue = builder.AddMaterial(vector3(0.1f, 0.2f, 0.8f), 0.4f, 0.0f);
+	builder.SetSky(vector3(0.6f, 0.6f, 0.6f));
+	builder.AddPlane(vector3(0.0f, 1.0f, 0.0f), -0.5f, floor);
+	builder.AddSphere(vector3(0.0f, 0.0f, -2.5f), 0.5f, glass);
+	builder.AddSphere(vector3(0.5f, 0.0f, -4.0f), 0.5f, blue);
+	return builder.Build();
+}
+
+// Queued shadow rays only reach the pixel of their path when nothing blocks them, and the blocker
+// stays in the cache until the cache is bound to another scene.
+static bool testShadowBatch(std::string *details)
+{
+	Expect expect;
+	SceneBuilder builder;
+	Material *white = builder.AddMaterial(vector3(1.0f, 1.0f, 1.0f), 1.0f, 0.0f);
+	builder.AddSphere(vector3(0.0f, 0.0f, 0.0f), 1.0f, white);
+	builder.AddLight(vector3(0.0f, 5.0f, 0.0f), vector3(1.0f, 1.0f, 1.0f), 1.0f);
+	std::unique_ptr<Scene> scene = builder.Build();
+
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+	OcclusionCache occlusion;
+	occlusion.Bind(*scene);
+	SpectrumSum pixels[2];
+	ShadowBatch shadows(scene.get(), &occlusion, nullptr, pixels);
+	const Spectrum contribution(vector3(1.0f, 2.0f, 3.0f));
+	auto towardsLight = [](vector3 origin, float *distance)
+	{
+		vector3 direction = vector3(0.0f, 5.0f, 0.0f) - origin;
+		*distance = direction.length();
+		return direction / *distance;
+	};
+
+	float distance;
+	shadows.BeginPath(0, nullptr);
+	vector3 blocked = towardsLight(vector3(0.0f, -3.0f, 0.0f), &distance);
+	shadows.Add(0, vector3(0.0f, -3.0f, 0.0f), blocked, distance, nullptr, contribution, 0);
+	shadows.BeginPath(1, nullptr);
+	vector3 free = towardsLight(vector3(3.0f, -3.0f, 0.0f), &distance);
+	shadows.Add(0, vector3(3.0f, -3.0f, 0.0f), free, distance, nullptr, contribution, 0);
+	shadows.Add(ShadowBatch::environment, vector3(3.0f, -3.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), std::numeric_limits<float>::infinity(), nullptr, contribution, 0);
+	expect(shadows.GetSize() == 3, "every ray should be queued");
+	shadows.Flush(gen, dis);
+
+	expect(shadows.GetSize() == 0, "the batch should be empty after a flush");
+	expect(pixels[0].Get()[0] == 0.0f, "a blocked ray should not reach its pixel");
+	expect(near(pixels[1].Get()[2], 6.0f, 1e-5f), "the free rays should reach their pixel");
+	expect(*occlusion.GetLight(0) != nullptr, "the blocker should be cached");
+	occlusion.Bind(*scene);
+	expect(*occlusion.GetLight(0) != nullptr, "binding the same scene should keep the blocker");
+	SceneBuilder otherBuilder;
+	otherBuilder.AddLight(vector3(0.0f, 5.0f, 0.0f), vector3(1.0f, 1.0f, 1.0f), 1.0f);
+	std::unique_ptr<Scene> other = otherBuilder.Build();
+	occlusion.Bind(*other);
+	expect(*occlusion.GetLight(0) == nullptr, "binding another scene should forget the blocker");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// Every node gets one copy of the scene, built by the first caller, that hits what the scene hits.
+static bool testSceneReplicas(std::string *details)
+{
+	Expect expect;
+	std::unique_ptr<Scene> scene = buildDiffuseScene();
+	SceneReplicas replicas(*scene, 2);
+	const Scene &first = replicas.Get(0);
+	const Scene &second = replicas.Get(1);
+	expect(&first != scene.get() && &second != scene.get() && &first != &second, "every node should get its own copy");
+	expect(&replicas.Get(0) == &first, "a node's copy should be built once");
+	expect(first.GetId() != scene->GetId(), "a copy should have an id of its own");
+
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+	int mismatches = 0;
+	for (int i = 0; i < 1000; ++i)
+	{
+		Ray ray(vector3(0.0f, 0.2f, 0.0f), vector3(dis(gen), dis(gen), -1.0f).normalized());
+		Ray copy = ray;
+		Hit hit;
+		Hit copyHit;
+		bool found = scene->Intersect(ray, &hit);
+		if (found != first.Intersect(copy, &copyHit) || (found && ray.tMax != copy.tMax))
+		{
+			mismatches++;
+		}
+	}
+	expect(mismatches == 0, std::to_string(mismatches) + " rays hit the copy elsewhere");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// The denoise passes a job runs on the pool give the same crop as Denoise on the tiles it rendered.
+static bool testDenoiseJob(std::string *details)
+{
+	Expect expect;
+	std::unique_ptr<Scene> scene = buildDiffuseScene();
+	RenderSettings settings = sceneSettings();
+	settings.sampleCount = 2;
+	settings.denoise = true;
+	settings.denoiseSettings.tileSize = 8;
+	settings.crop = { 5, 3, 61, 40 };
+	const PixelRect &crop = settings.crop;
+	const int cropW = crop.x2 - crop.x1;
+	const int cropH = crop.y2 - crop.y1;
+
+	std::vector<float> color(cropW * cropH * 3);
+	FeatureBuffers features(cropW, cropH);
+	std::mutex lock;
+	auto onTile = [&](const RenderJob &job, const tileData &tile)
+	{
+		std::scoped_lock guard(lock);
+		for (int y = tile.y1; y < tile.y2; ++y)
+		{
+			for (int x = tile.x1; x < tile.x2; ++x)
+			{
+				int source = (y - tile.y1) * job.GetTileSize() + x - tile.x1;
+				int target = (y - crop.y1) * cropW + x - crop.x1;
+				std::copy_n(tile.tileOutput + source * 3, 3, color.begin() + target * 3);
+				std::copy_n(tile.albedoOutput + source * 3, 3, features.albedo.begin() + target * 3);
+				std::copy_n(tile.normalOutput + source * 3, 3, features.normal.begin() + target * 3);
+				features.depth[target] = tile.depthOutput[source];
+			}
+		}
+	};
+
+	Renderer renderer(4);
+	std::shared_ptr<RenderJob> job = renderer.Submit(*scene, settings, onTile);
+	if (!job->Wait())
+	{
+		*details = "render cancelled";
+		return false;
+	}
+
+	std::vector<float> denoised(color.size());
+	Denoise(color.data(), features, cropW, cropH, settings.denoiseSettings, 1, denoised.data());
+	const std::vector<float> &frame = job->GetFramebuffer();
+	int mismatches = 0;
+	for (int y = 0; y < cropH; ++y)
+	{
+		for (int x = 0; x < cropW * 3; ++x)
+		{
+			mismatches += frame[((crop.y1 + y) * settings.width + crop.x1) * 3 + x] != denoised[y * cropW * 3 + x];
+		}
+	}
+	expect(mismatches == 0, std::to_string(mismatches) + " values differ from Denoise");
+	expect(frame[0] == 0.0f && frame.back() == 0.0f, "the frame should stay black outside of the crop");
+	*details = expect.GetFailure();
+	return expect.Passed();
+}
+
+// Running mean and variance of a vector of values over independent runs.
+class Moments
+{
+public:
+	void Add(const std::vector<double> &values)
+	{
+		m_sum.resize(values.size(), 0.0);
+		m_sumSquares.resize(values.size(), 0.0);
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			m_sum[i] += values[i];
+			m_sumSquares[i] += values[i] * values[i];
+		}
+		m_count++;
+	}
+	size_t GetSize() const { return m_sum.size(); }
+	double GetMean(size_t i) const { return m_sum[i] / m_count; }
+	// Of the mean, the reference it is compared with adds referenceShare of the variance.
+	double GetStandardError(size_t i, double referenceShare) const
+	{
+		double variance = std::max(0.0, (m_sumSquares[i] - m_sum[i] * GetMean(i)) / (m_count - 1));
+		return std::sqrt(variance / m_count * (1.0 + referenceShare));
+	}
+
+private:
+	std::vector<double> m_sum;
+	std::vector<double> m_sumSquares;
+	int m_count = 0;
+};
+
+// Means of blockSize pixel blocks over all channels, followed by the mean of the whole image.
+static std::vector<double> blockMeans(const std::vector<float> &image, int width, int height, int blockSize)
+{
+	const int blocksX = divideRoundingUp(width, blockSize);
+	const int blocksY = divideRoundingUp(height, blockSize);
+	std::vector<double> sums(blocksX * blocksY + 1, 0.0);
+	std::vector<int> counts(sums.size(), 0);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			int block = (y / blockSize) * blocksX + x / blockSize;
+			for (int c = 0; c < 3; ++c)
+			{
+				sums[block] += image[(y * width + x) * 3 + c];
+				sums.back() += image[(y * width + x) * 3 + c];
+			}
+			counts[block] += 3;
+			counts.back() += 3;
+		}
+	}
+	for (size_t i = 0; i < sums.size(); ++i)
+	{
+		sums[i] /= counts[i];
+	}
+	return sums;
+}
+
+// Renders runs independent images of the scene and compares them with the stored reference using
+// Student's t with the spread of the runs:
+// - blocks of pixels must match, which catches bias in a part of the frame, and so must the image
+//   mean, which catches small biases spread over all of it;
+// - single pixels are heavy tailed, only a small share may be far off;
+// - the RMSE must stay close to what the noise of the runs explains.
+static bool testScene(const std::string &name, const std::function<std::unique_ptr<Scene>()> &build, std::string *details)
+{
+	static const int runs = 32;
+	static const int runSamples = 4;
+	static const int referenceRuns = 1024;
+	static const int blockSize = 8;
+	static const float blockT = 5.0f;
+	static const float pixelT = 5.0f;
+	static const float maxOutlierShare = 0.03f;
+	static const float rmseFactor = 1.5f;
+
+	std::unique_ptr<Scene> scene = build();
+	RenderSettings settings = sceneSettings();
+	Renderer renderer;
+	const std::string path = referenceDirectory + name + ".pfm";
+
+	// pixels are sampled at the same Hammersley positions in every run, so the reference is a mean of
+	// runs as well; a single high sample render would integrate the pixel footprint more finely
+	settings.sampleCount = runSamples;
+	auto render = [&](std::vector<double> *image)
+	{
+		std::shared_ptr<RenderJob> job = renderer.Submit(*scene, settings);
+		if (!job->Wait()) return false;
+		image->assign(job->GetFramebuffer().begin(), job->GetFramebuffer().end());
+		return true;
+	};
+
+	std::vector<double> image;
+	if (updateReferences)
+	{
+		std::vector<double> referenceSum(settings.width * settings.height * 3, 0.0);
+		for (int run = 0; run < referenceRuns; ++run)
+		{
+			if (!render(&image))
+			{
+				*details = "render cancelled";
+				return false;
+			}
+			for (size_t i = 0; i < referenceSum.size(); ++i)
+			{
+				referenceSum[i] += image[i];
+			}
+		}
+		std::vector<float> reference(referenceSum.size());
+		for (size_t i = 0; i < reference.size(); ++i)
+		{
+			reference[i] = static_cast<float>(referenceSum[i] / referenceRuns);
+		}
+		if (!WritePFM(path, settings.width, settings.height, reference.data()))
+		{
+			*details = "cannot write " + path;
+			return false;
+		}
+	}
+
+	int width;
+	int height;
+	std::vector<float> reference;
+	if (!ReadPFM(path, &width, &height, &reference) || width != settings.width || height != settings.height)
+	{
+		*details = "missing reference " + path + ", run rt_test --update-references";
+		return false;
+	}
+
+	Moments pixels;
+	Moments blocks;
+	for (int run = 0; run < runs; ++run)
+	{
+		if (!render(&image))
+		{
+			*details = "render cancelled";
+			return false;
+		}
+		pixels.Add(image);
+		blocks.Add(blockMeans(std::vector<float>(image.begin(), image.end()), width, height, blockSize));
+	}
+
+	// the reference is a mean of its own, with referenceRuns / runs times less variance
+	const double referenceShare = static_cast<double>(runs) / referenceRuns;
+	int outliers = 0;
+	double squaredError = 0.0;
+	double expectedSquaredError = 0.0;
+	for (size_t i = 0; i < pixels.GetSize(); ++i)
+	{
+		double error = pixels.GetMean(i) - reference[i];
+		double standardError = pixels.GetStandardError(i, referenceShare);
+		if (!std::isfinite(error))
+		{
+			*details = "non-finite pixel";
+			return false;
+		}
+		// pixels without noise, such as the sky, have to match exactly
+		if (std::abs(error) > std::max(pixelT * standardError, 1e-4 * (1.0 + std::abs(reference[i]))))
+		{
+			outliers++;
+		}
+		squaredError += error * error;
+		expectedSquaredError += standardError * standardError;
+	}
+
+	const std::vector<double> referenceBlocks = blockMeans(reference, width, height, blockSize);
+	const size_t imageMean = referenceBlocks.size() - 1;
+	auto tValue = [&](size_t i)
+	{
+		double error = blocks.GetMean(i) - referenceBlocks[i];
+		double standardError = blocks.GetStandardError(i, referenceShare);
+		return standardError > 0.0 ? error / standardError : (std::abs(error) > 1e-6 ? std::numeric_limits<double>::infinity() : 0.0);
+	};
+	double worstBlockT = 0.0;
+	for (size_t i = 0; i < imageMean; ++i)
+	{
+		worstBlockT = std::max(worstBlockT, std::abs(tValue(i)));
+	}
+	const double bias = blocks.GetMean(imageMean) / referenceBlocks[imageMean] - 1.0;
+	const double rmse = std::sqrt(squaredError / pixels.GetSize());
+	const double expectedRmse = std::sqrt(expectedSquaredError / pixels.GetSize());
+
+	std::ostringstream summary;
+	summary << std::setprecision(3) << "rmse " << rmse << " (noise " << expectedRmse << "), bias " << 100.0 * bias
+		<< "% (t " << tValue(imageMean) << "), worst block t " << worstBlockT << ", " << outliers << " outlier pixel channels";
+	*details = summary.str();
+	bool passed = true;
+	if (std::abs(tValue(imageMean)) > blockT)
+	{
+		*details += ", biased";
+		passed = false;
+	}
+	if (worstBlockT > blockT)
+	{
+		*details += ", biased block";
+		passed = false;
+	}
+	if (outliers > maxOutlierShare * pixels.GetSize())
+	{
+		*details += ", too many outliers";
+		passed = false;
+	}
+	if (rmse > rmseFactor * expectedRmse + 1e-6)
+	{
+		*details += ", rmse too high";
+		passed = false;
+	}
+	return passed;
+}
+
+struct Test
+{
+	std::string name;
+	std::function<bool(std::string *details)> run;
+};
+
+static std::map<std::string, double> readTimings()
+{
+	std::map<std::string, double> timings;
+	std::ifstream file(timingsFile);
+	std::string name;
+	double seconds;
+	while (file >> name >> seconds)
+	{
+		timings[name] = seconds;
+	}
+	return timings;
+}
+
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--update-references") == 0)
+		{
+			updateReferences = true;
+		}
+		else
+		{
+			std::cerr << "usage: rt_test [--update-references]" << std::endl;
+			return 2;
+		}
+	}
+
+	const std::vector<Test> tests =
+	{
+		{ "sphere_intersect", testSphereIntersect },
+		{ "plane_intersect", testPlaneIntersect },
+		{ "mesh_compression", testMeshCompression },
+		{ "hammersley", testHammersley },
+		{ "brdf_energy", testBrdfEnergy },
+		{ "dispersion", testDispersion },
+		{ "texture_validation", testTextureValidation },
+		{ "denoise_job", testDenoiseJob },
+		{ "scene_replicas", testSceneReplicas },
+		{ "shadow_batch", testShadowBatch },
+		{ "scene_diffuse", [](std::string *details) { return testScene("diffuse", buildDiffuseScene, details); } },
+		{ "scene_metal", [](std::string *details) { return testScene("metal", buildMetalScene, details); } },
+		{ "scene_glass", [](std::string *details) { return testScene("glass", buildGlassScene, details); } },
+	};
+
+	const std::map<std::string, double> baseline = readTimings();
+	std::map<std::string, double> timings;
+	int failures = 0;
+	for (const Test &test : tests)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::string details;
+		bool passed = test.run(&details);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		timings[test.name] = seconds;
+
+		auto expected = baseline.find(test.name);
+		bool slow = !updateReferences && expected != baseline.end() && seconds > expected->second * slowFactor + slowMargin;
+		std::cout << (passed ? "PASS " : "FAIL ") << std::left << std::setw(18) << test.name << std::right
+			<< std::fixed << std::setprecision(3) << std::setw(8) << seconds << " s";
+		if (expected != baseline.end())
+		{
+			std::cout << " (baseline " << expected->second << " s)";
+		}
+		if (slow)
+		{
+			std::cout << " SLOW";
+		}
+		std::cout.unsetf(std::ios::fixed);
+		if (!details.empty())
+		{
+			std::cout << "  " << details;
+		}
+		std::cout << std::endl;
+		failures += passed ? 0 : 1;
+	}
+
+	if (updateReferences)
+	{
+		// the reference renders are part of the scene tests' time, the baseline has to come from a normal run
+		std::cout << "references written, run again without --update-references to record the timings" << std::endl;
+		std::remove(timingsFile);
+	}
+	else if (baseline.empty())
+	{
+		std::ofstream file(timingsFile);
+		for (const auto &timing : timings)
+		{
+			file << timing.first << " " << timing.second << "\n";
+		}
+		std::cout << "timings recorded in " << timingsFile << std::endl;
+	}
+
+	std::cout << failures << " of " << tests.size() << " tests failed" << std::endl;
+	return failures > 0 ? 1 : 0;
+}
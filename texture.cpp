@@ -0,0 +1,91 @@
+#include "texture.h"
+#include "texturecache.h"
+
+#include <algorithm>
+#include <cmath>
+
+TiledTexture::TiledTexture(TextureCache &cache, int texture): m_cache(cache), m_texture(texture)
+{
+}
+
+int TiledTexture::GetWidth() const
+{
+	return m_cache.GetHeader(m_texture).width;
+}
+
+int TiledTexture::GetHeight() const
+{
+	return m_cache.GetHeader(m_texture).height;
+}
+
+int TiledTexture::GetLevelCount() const
+{
+	return m_cache.GetHeader(m_texture).levelCount;
+}
+
+float TiledTexture::GetLod(float uvWidth) const
+{
+	float texels = uvWidth * std::max(GetWidth(), GetHeight());
+	return texels > 1.0f ? std::log2(texels) : 0.0f;
+}
+
+vector3 TiledTexture::Sample(float u, float v, float lod) const
+{
+	float maxLevel = static_cast<float>(GetLevelCount() - 1);
+	lod = clamp(lod, 0.0f, maxLevel);
+	int level = static_cast<int>(lod);
+	float t = lod - level;
+
+	vector3 result = SampleLevel(u, v, level);
+	if (t > 0.0f && level < maxLevel)
+	{
+		result = lerp(result, SampleLevel(u, v, level + 1), t);
+	}
+	return result;
+}
+
+vector3 TiledTexture::SampleLevel(float u, float v, int level) const
+{
+	const TiledTextureLevel &info = m_cache.GetLevel(m_texture, level);
+	const int tileSize = m_cache.GetHeader(m_texture).tileSize;
+	const int w = info.width;
+	const int h = info.height;
+
+	// bilinear footprint in texel space, texel centers sit at half integers
+	float x = (u - std::floor(u)) * w - 0.5f;
+	float y = (v - std::floor(v)) * h - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	float wx = x - fx;
+	float wy = y - fy;
+	int x0 = (static_cast<int>(fx) + w) % w;
+	int y0 = (static_cast<int>(fy) + h) % h;
+	int xs[2] = { x0, (x0 + 1) % w };
+	int ys[2] = { y0, (y0 + 1) % h };
+
+	// most footprints fall into one tile, only fetch another one when crossing a tile border
+	std::shared_ptr<const TextureTile> tile;
+	int tileX = -1;
+	int tileY = -1;
+
+	vector3 texels[4];
+	for (int j = 0; j < 2; ++j)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			int tx = xs[i] / tileSize;
+			int ty = ys[j] / tileSize;
+			if (tx != tileX || ty != tileY)
+			{
+				tile = m_cache.GetTile(m_texture, level, tx, ty);
+				tileX = tx;
+				tileY = ty;
+			}
+			int lx = xs[i] - tx * tileSize;
+			int ly = ys[j] - ty * tileSize;
+			texels[j * 2 + i] = vector3(tile->Fetch(lx, ly, 0), tile->Fetch(lx, ly, 1), tile->Fetch(lx, ly, 2));
+		}
+	}
+
+	return lerp(lerp(texels[0], texels[1], wx), lerp(texels[2], texels[3], wx), wy);
+}
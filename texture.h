@@ -0,0 +1,35 @@
+#pragma once
+
+#include "math.h"
+
+class TextureCache;
+
+class Texture
+{
+public:
+	virtual ~Texture() {}
+	// lod is the mip level to sample, fractional values blend between neighbouring levels.
+	virtual vector3 Sample(float u, float v, float lod) const = 0;
+	// Mip level matching a footprint of uvWidth in uv units.
+	virtual float GetLod(float) const { return 0.0f; }
+};
+
+// Texture backed by a tiled file streamed through a TextureCache, uv wraps around.
+class TiledTexture: public Texture
+{
+public:
+	TiledTexture(TextureCache &cache, int texture);
+	~TiledTexture() override {}
+	vector3 Sample(float u, float v, float lod) const override;
+	float GetLod(float uvWidth) const override;
+
+	int GetWidth() const;
+	int GetHeight() const;
+	int GetLevelCount() const;
+
+private:
+	vector3 SampleLevel(float u, float v, int level) const;
+
+	TextureCache &m_cache;
+	int m_texture;
+};
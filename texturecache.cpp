@@ -0,0 +1,350 @@
+#include "texturecache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t pageSize = 4096;
+
+static size_t alignToPage(size_t offset)
+{
+	return (offset + pageSize - 1) / pageSize * pageSize;
+}
+
+static uint8_t encode(float linear, bool srgb)
+{
+	float v = std::min(std::max(linear, 0.0f), 1.0f);
+	if (srgb)
+	{
+		v = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+	}
+	return static_cast<uint8_t>(v * 255.0f + 0.5f);
+}
+
+struct DecodeTable
+{
+	DecodeTable()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float v = i / 255.0f;
+			linear[i] = v;
+			srgb[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+		}
+	}
+
+	float linear[256];
+	float srgb[256];
+};
+
+static const DecodeTable decodeTable;
+
+float TextureTile::Fetch(int x, int y, int channel) const
+{
+	uint8_t value = texels[(y * size + x) * 4 + channel];
+	return srgb ? decodeTable.srgb[value] : decodeTable.linear[value];
+}
+
+bool WriteTiledTexture(const std::string &path, int width, int height, const float *rgb, bool srgb, int tileSize)
+{
+	std::vector<std::vector<float>> levels;
+	std::vector<TiledTextureLevel> levelInfo;
+	levels.emplace_back(rgb, rgb + width * height * 3);
+
+	// 2x2 box filtered mip chain, odd dimensions round up and repeat the last row or column
+	int w = width;
+	int h = height;
+	while (true)
+	{
+		TiledTextureLevel info;
+		info.width = w;
+		info.height = h;
+		info.tilesX = (w + tileSize - 1) / tileSize;
+		info.tilesY = (h + tileSize - 1) / tileSize;
+		info.offset = 0;
+		levelInfo.push_back(info);
+
+		if (w == 1 && h == 1) break;
+
+		int nw = (w + 1) / 2;
+		int nh = (h + 1) / 2;
+		const std::vector<float> &src = levels.back();
+		std::vector<float> dst(nw * nh * 3);
+		for (int y = 0; y < nh; ++y)
+		{
+			for (int x = 0; x < nw; ++x)
+			{
+				int x0 = std::min(x * 2, w - 1);
+				int x1 = std::min(x * 2 + 1, w - 1);
+				int y0 = std::min(y * 2, h - 1);
+				int y1 = std::min(y * 2 + 1, h - 1);
+				for (int c = 0; c < 3; ++c)
+				{
+					dst[(y * nw + x) * 3 + c] = 0.25f * (src[(y0 * w + x0) * 3 + c] + src[(y0 * w + x1) * 3 + c]
+						+ src[(y1 * w + x0) * 3 + c] + src[(y1 * w + x1) * 3 + c]);
+				}
+			}
+		}
+		levels.push_back(std::move(dst));
+		w = nw;
+		h = nh;
+	}
+
+	TiledTextureHeader header;
+	std::memcpy(header.magic, "RTT1", 4);
+	header.width = width;
+	header.height = height;
+	header.tileSize = tileSize;
+	header.levelCount = static_cast<uint32_t>(levelInfo.size());
+	header.srgb = srgb ? 1 : 0;
+
+	const size_t tileBytes = tileSize * tileSize * 4;
+	size_t offset = alignToPage(sizeof(header) + levelInfo.size() * sizeof(TiledTextureLevel));
+	for (auto &info : levelInfo)
+	{
+		info.offset = offset;
+		offset += alignToPage(info.tilesX * info.tilesY * tileBytes);
+	}
+
+	std::ofstream f(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!f) return false;
+
+	f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	f.write(reinterpret_cast<const char *>(levelInfo.data()), levelInfo.size() * sizeof(TiledTextureLevel));
+
+	std::vector<uint8_t> tile(tileBytes);
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		const TiledTextureLevel &info = levelInfo[level];
+		const std::vector<float> &src = levels[level];
+		f.seekp(info.offset);
+		for (uint32_t ty = 0; ty < info.tilesY; ++ty)
+		{
+			for (uint32_t tx = 0; tx < info.tilesX; ++tx)
+			{
+				// texels past the edge of the level repeat the border so filtering never reads garbage
+				for (int y = 0; y < tileSize; ++y)
+				{
+					int sy = std::min<int>(ty * tileSize + y, info.height - 1);
+					for (int x = 0; x < tileSize; ++x)
+					{
+						int sx = std::min<int>(tx * tileSize + x, info.width - 1);
+						uint8_t *texel = &tile[(y * tileSize + x) * 4];
+						texel[0] = encode(src[(sy * info.width + sx) * 3 + 0], srgb);
+						texel[1] = encode(src[(sy * info.width + sx) * 3 + 1], srgb);
+						texel[2] = encode(src[(sy * info.width + sx) * 3 + 2], srgb);
+						texel[3] = 255;
+					}
+				}
+				f.write(reinterpret_cast<const char *>(tile.data()), tile.size());
+			}
+		}
+	}
+	// make sure the file covers the page padding of the last level
+	f.seekp(offset - 1);
+	f.put(0);
+
+	return static_cast<bool>(f);
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = nullptr;
+		return;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping) return;
+	m_data = static_cast<const uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) CloseHandle(m_file);
+}
+
+void MappedFile::Release(size_t offset, size_t size) const
+{
+	// unlocking pages that are not locked just trims them from the working set
+	VirtualUnlock(const_cast<uint8_t *>(m_data + offset), size);
+}
+#else
+MappedFile::MappedFile(const std::string &path)
+{
+	m_file = open(path.c_str(), O_RDONLY);
+	if (m_file < 0) return;
+
+	struct stat st;
+	if (fstat(m_file, &st) != 0 || st.st_size == 0) return;
+
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, m_file, 0);
+	if (data == MAP_FAILED) return;
+
+	madvise(data, st.st_size, MADV_RANDOM);
+	m_data = static_cast<const uint8_t *>(data);
+	m_size = st.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data) munmap(const_cast<uint8_t *>(m_data), m_size);
+	if (m_file >= 0) close(m_file);
+}
+
+void MappedFile::Release(size_t offset, size_t size) const
+{
+	size_t begin = offset / pageSize * pageSize;
+	madvise(const_cast<uint8_t *>(m_data + begin), offset + size - begin, MADV_DONTNEED);
+}
+#endif
+
+TextureCache::TextureCache(size_t maxResidentBytes): m_maxResidentBytes(maxResidentBytes)
+{
+}
+
+TextureCache::~TextureCache()
+{
+}
+
+// Checks the header and that every level's tiles lie within the file, so lookups that stay
+// inside the level table never read past the mapping.
+static bool validateLayout(const uint8_t *data, size_t size)
+{
+	if (size < sizeof(TiledTextureHeader)) return false;
+	const TiledTextureHeader *header = reinterpret_cast<const TiledTextureHeader *>(data);
+	if (std::memcmp(header->magic, "RTT1", 4) != 0) return false;
+	// tile keys hold 8 bits of level and 20 bits per tile coordinate
+	if (header->tileSize == 0 || header->tileSize > 4096 || header->levelCount == 0 || header->levelCount > 32) return false;
+	if (size < sizeof(TiledTextureHeader) + static_cast<uint64_t>(header->levelCount) * sizeof(TiledTextureLevel)) return false;
+
+	const TiledTextureLevel *levels = reinterpret_cast<const TiledTextureLevel *>(data + sizeof(TiledTextureHeader));
+	const uint64_t tileBytes = static_cast<uint64_t>(header->tileSize) * header->tileSize * 4;
+	for (uint32_t i = 0; i < header->levelCount; ++i)
+	{
+		const TiledTextureLevel &level = levels[i];
+		if (level.width == 0 || level.height == 0 || level.width > (1u << 20) || level.height > (1u << 20)) return false;
+		if (level.tilesX != (level.width + header->tileSize - 1) / header->tileSize
+			|| level.tilesY != (level.height + header->tileSize - 1) / header->tileSize) return false;
+		const uint64_t levelBytes = static_cast<uint64_t>(level.tilesX) * level.tilesY * tileBytes;
+		if (level.offset > size || levelBytes > size - level.offset) return false;
+	}
+	return true;
+}
+
+int TextureCache::Open(const std::string &path)
+{
+	auto file = std::make_unique<MappedFile>(path);
+	if (!file->IsValid() || !validateLayout(file->GetData(), file->GetSize())) return -1;
+
+	auto texture = std::make_unique<TextureFile>();
+	texture->header = reinterpret_cast<const TiledTextureHeader *>(file->GetData());
+	texture->levels = reinterpret_cast<const TiledTextureLevel *>(file->GetData() + sizeof(TiledTextureHeader));
+	texture->file = std::move(file);
+
+	std::scoped_lock lock(m_openLock);
+	if (m_textureCount == maxTextureCount) return -1;
+	m_textures[m_textureCount] = std::move(texture);
+	return m_textureCount++;
+}
+
+const TiledTextureHeader &TextureCache::GetHeader(int texture) const
+{
+	return *m_textures[texture]->header;
+}
+
+const TiledTextureLevel &TextureCache::GetLevel(int texture, int level) const
+{
+	return m_textures[texture]->levels[level];
+}
+
+std::shared_ptr<const TextureTile> TextureCache::LoadTile(const TextureFile &texture, int level, int tileX, int tileY) const
+{
+	const TiledTextureLevel &info = texture.levels[level];
+	const int tileSize = texture.header->tileSize;
+	const size_t tileBytes = tileSize * tileSize * 4;
+	const size_t offset = info.offset + (tileY * info.tilesX + tileX) * tileBytes;
+
+	auto tile = std::make_shared<TextureTile>();
+	tile->size = tileSize;
+	tile->srgb = texture.header->srgb != 0;
+	const uint8_t *src = texture.file->GetData() + offset;
+	tile->texels.assign(src, src + tileBytes);
+
+	// the resident copy is what counts against the budget, the mapped pages can go
+	texture.file->Release(offset, tileBytes);
+	return tile;
+}
+
+std::shared_ptr<const TextureTile> TextureCache::GetTile(int texture, int level, int tileX, int tileY)
+{
+	const uint64_t key = (static_cast<uint64_t>(texture) << 48) | (static_cast<uint64_t>(level) << 40)
+		| (static_cast<uint64_t>(tileY) << 20) | static_cast<uint64_t>(tileX);
+	Shard &shard = m_shards[(key * 0x9E3779B97F4A7C15ull) >> 60];
+
+	{
+		std::scoped_lock lock(shard.lock);
+		auto it = shard.entries.find(key);
+		if (it != shard.entries.end())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return it->second->tile;
+		}
+	}
+
+	// decode outside of the lock, two threads racing for the same tile just do the work twice
+	std::shared_ptr<const TextureTile> tile = LoadTile(*m_textures[texture], level, tileX, tileY);
+	const size_t tileBytes = tile->texels.size();
+
+	std::scoped_lock lock(shard.lock);
+	auto it = shard.entries.find(key);
+	if (it != shard.entries.end())
+	{
+		return it->second->tile;
+	}
+
+	shard.lru.push_front({ key, tile });
+	shard.entries[key] = shard.lru.begin();
+	shard.residentBytes += tileBytes;
+
+	// tiles still in use by other threads stay alive through their shared_ptr until released
+	const size_t shardBudget = m_maxResidentBytes / shardCount;
+	while (shard.residentBytes > shardBudget && shard.lru.size() > 1)
+	{
+		Entry &victim = shard.lru.back();
+		shard.residentBytes -= victim.tile->texels.size();
+		shard.entries.erase(victim.key);
+		shard.lru.pop_back();
+	}
+
+	return tile;
+}
+
+size_t TextureCache::GetResidentBytes() const
+{
+	size_t bytes = 0;
+	for (const Shard &shard : m_shards)
+	{
+		std::scoped_lock lock(shard.lock);
+		bytes += shard.residentBytes;
+	}
+	return bytes;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk layout of a tiled texture (.rtt). Every mip level is cut into square tiles of
+// tileSize * tileSize RGBA8 texels, tiles start on page boundaries so they can be paged in and
+// dropped independently of each other.
+struct TiledTextureHeader
+{
+	char magic[4];
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t levelCount;
+	uint32_t srgb;
+};
+
+struct TiledTextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	uint32_t tilesY;
+	uint64_t offset;
+};
+
+// Writes linear RGB data as a mip-mapped tiled texture. srgb selects the encoding of the 8 bit
+// texels, use it for colors and leave it off for data such as roughness.
+bool WriteTiledTexture(const std::string &path, int width, int height, const float *rgb, bool srgb, int tileSize = 64);
+
+class MappedFile
+{
+public:
+	MappedFile(const std::string &path);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool IsValid() const { return m_data != nullptr; }
+	const uint8_t *GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+	// Tells the OS the mapped pages of the range are no longer needed, they are re-read on next access.
+	void Release(size_t offset, size_t size) const;
+
+private:
+	const uint8_t *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+};
+
+class TextureTile
+{
+public:
+	// Linear value of one channel of the texel at x, y.
+	float Fetch(int x, int y, int channel) const;
+
+	int size;
+	bool srgb;
+	std::vector<uint8_t> texels; // RGBA8, decoded on fetch to keep resident tiles small
+};
+
+// Keeps tiles of any number of tiled textures resident, up to a fixed memory budget shared
+// by all threads. Tiles are read on first use and the least recently used ones are evicted.
+class TextureCache
+{
+public:
+	TextureCache(size_t maxResidentBytes);
+	~TextureCache();
+
+	static const int maxTextureCount = 4096;
+
+	// Returns a handle for the texture at path or -1 if it cannot be mapped, is truncated or
+	// malformed, or maxTextureCount textures are open. Safe to call while other threads sample.
+	int Open(const std::string &path);
+	const TiledTextureHeader &GetHeader(int texture) const;
+	// level and the tile coordinates below have to be within the header's and level's counts.
+	const TiledTextureLevel &GetLevel(int texture, int level) const;
+	std::shared_ptr<const TextureTile> GetTile(int texture, int level, int tileX, int tileY);
+
+	size_t GetResidentBytes() const;
+	size_t GetMaxResidentBytes() const { return m_maxResidentBytes; }
+
+private:
+	static const int shardCount = 16;
+
+	struct TextureFile
+	{
+		std::unique_ptr<MappedFile> file;
+		const TiledTextureHeader *header;
+		const TiledTextureLevel *levels;
+	};
+
+	struct Entry
+	{
+		uint64_t key;
+		std::shared_ptr<const TextureTile> tile;
+	};
+
+	struct Shard
+	{
+		mutable std::mutex lock;
+		std::list<Entry> lru; // most recently used at the front
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+		size_t residentBytes = 0;
+	};
+
+	std::shared_ptr<const TextureTile> LoadTile(const TextureFile &texture, int level, int tileX, int tileY) const;
+
+	size_t m_maxResidentBytes;
+	std::mutex m_openLock;
+	// never reallocated, so lookups need no lock while Open fills the next slot
+	std::unique_ptr<TextureFile> m_textures[maxTextureCount];
+	int m_textureCount = 0;
+	Shard m_shards[shardCount];
+};